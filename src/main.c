@@ -1,65 +1,420 @@
+#define _POSIX_C_SOURCE 200809L // fseeko
 #include "raylib.h"
 #include "raymath.h"
 #include "rlgl.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+    #include <unistd.h> // ftruncate
+#else
+    #include <io.h> // _chsize_s
+#endif
 
 //--- Defines ---
 #define CHUNK_SIZE 1024
+#define CHUNK_BYTES ((size_t)CHUNK_SIZE * CHUNK_SIZE * sizeof(Color))
 #define CHUNK_LOAD_PADDING 1
 #define CHUNK_POOL_RADIUS 5
-#define MAX_CACHED_CHUNKS 512
+#define ATLAS_PAGE_CHUNKS 4 // Chunk slots per side of an atlas page; 4096px pages stay within common texture size limits
+#define ATLAS_SLOTS_PER_PAGE (ATLAS_PAGE_CHUNKS * ATLAS_PAGE_CHUNKS)
+#define ATLAS_PAGE_SIZE (CHUNK_SIZE * ATLAS_PAGE_CHUNKS)
+#define CPU_CACHE_BUDGET_MB 512 // RAM for evicted chunks before they spill to disk
+#define CACHE_EDIT_SETTLE_FRAMES 30 // Chunks painted on in RAM are compressed once left alone this long
+#define PREFETCH_LOOKAHEAD_FRAMES 20 // How far ahead camera motion is extrapolated
+#define PREFETCH_SMOOTHING 0.3f      // Weight of the latest frame in the smoothed camera motion
+#define PREFETCH_UPLOADS_PER_FRAME 2 // Chunks warmed up ahead of the view per frame, at most
+#define CAMERA_MIN_ZOOM 0.01f
+#define LOD_LEVELS 7 // Level 0 is the chunk grid, level L tiles cover 2^L x 2^L chunks; level 6 is shown at CAMERA_MIN_ZOOM
+#define LOD_POOL_SIZE 64
+#define LOD_CACHE_BUDGET_MB 256 // RAM for pyramid tiles, beyond this the least recently used are dropped
+#define LOD_BUILD_MS 2.0 // Time per frame spent building pyramid tiles on screen
+#define LOD_IDLE_EVICT_FRAMES 120
 #define TEXT_INPUT_MAX 255
 #define BASE_FONT_SIZE 256
 #define COLOR_PICKER_GAMMA 1.5f
-#define MAX_UNDO_ACTIONS 100
+#define UNDO_BUDGET_MB 512 // Oldest undo steps are dropped beyond this much captured pixel data
+#define UNDO_VRAM_BUDGET_MB 256 // Undo snapshots stay on the GPU up to this much, then move to RAM; 0 keeps them all in RAM
+#define RENDER_POOL_SPARE_MB 64 // Released render targets kept for reuse, beyond this the oldest are unloaded
+#define RENDER_TARGET_DEPTH_BYTES 4 // Per pixel of the 24-bit depth renderbuffer LoadRenderTexture attaches, as drivers store it
+#define UNDO_TILE_SIZE 64 // Undo keeps only the tiles of a chunk a stroke touched
+#define UNDO_TILES_PER_SIDE (CHUNK_SIZE / UNDO_TILE_SIZE)
+#define UNDO_CAPTURE_PADDING 2.0f // World pixels around a stroke's bounds, for antialiased edges
 #define SAVE_FILE_MAGIC 0x43414E56 // "CANV"
-#define SAVE_FILE_VERSION 1
+#define SAVE_FILE_VERSION 2
+#define SAVE_FILE_INDEX_MAGIC 0x58444E49 // "INDX", last field of a v2 file
+#define RLE_MAX_RUN 0x8000 // Pixels per RLE packet, so the count fits a 15-bit header
+#define SAVE_COMPACT_GARBAGE 0.5 // Compact once superseded blobs make up this share of the save file
+#define READBACK_MAX_BUFFERS 64 // Pixel buffer objects in flight before readbacks fall back to blocking
 
 //--- Structs ---
 typedef struct CanvasChunk {
-    RenderTexture2D texture;
+    int slot; // Pixels live in this slot of canvas->atlas
     Vector2 gridPos;
     bool active;
     bool modified;
+    bool lodDirty; // Contents are newer than the LOD pyramid
+    bool prefetched; // Loaded ahead of the view and not yet in it
+    unsigned int lastUsedFrame;
 } CanvasChunk;
 
+// A chunk handed to the compression worker. The worker only reads pixels, so
+// the raw image stays usable until the packed result has been collected.
+typedef struct CompressJob {
+    const Color *pixels;
+    int cacheIndex;         // Owning slot in canvas->cache
+    unsigned char *packed;  // Set by the worker, NULL if the chunk didn't shrink
+    size_t packedSize;
+    bool orphaned;          // Owner let go of the chunk; free everything on collection
+    struct CompressJob *next;
+} CompressJob;
+
 typedef struct CachedChunk {
-    Image image;
+    Image image;           // Raw pixels, data is NULL once compressed
+    unsigned char *packed; // RLE stream, see Rle_Encode
+    size_t packedSize;
+    CompressJob *job;      // Compression in flight, or NULL
     Vector2 gridPos;
     bool active;
+    bool editing;  // Being painted on in RAM: kept raw, not handed to the compressor
+    bool lodDirty; // Painted on since the LOD pyramid last saw it
+    unsigned int lastUsedFrame; // Frame the chunk left the GPU pool or was last painted on
 } CachedChunk;
 
+// Scratch file holding chunks evicted from RAM, in fixed CHUNK_BYTES slots
+typedef struct SpillFile {
+    FILE *file;
+    int slotCount;  // Slots handed out so far; the file is this many chunks long
+    int *freeSlots; // Released slots, reused before the file grows
+    int freeCount;
+    int freeCapacity;
+} SpillFile;
+
+// A resident chunk on its way out of the GPU pool. The atlas slot is kept
+// until its pixels have been read back, so the chunk can be taken back
+// into the pool without waiting if it is needed again in the meantime.
+typedef struct PendingEviction {
+    struct Canvas *canvas;
+    Vector2 gridPos;
+    int slot;
+    void *pixels;   // Readback destination
+    bool lodDirty;
+    bool cancelled; // Texture was taken back or discarded, drop the pixels
+} PendingEviction;
+
+// --- Render Target Pool ---
+// Render textures that went out of use, kept so the next request of the same
+// size is handed one back instead of allocating a new framebuffer and textures.
+typedef struct RenderTargetPool {
+    RenderTexture2D *targets; // Oldest first
+    int count;
+    int capacity;
+    size_t bytes; // Colour buffers held by the pool
+    size_t depthBytesSaved; // Depth buffers that live colour-only targets were created without
+} RenderTargetPool;
+
+// --- Chunk Atlas ---
+// Resident chunks live in fixed slots of a few large render textures ("pages")
+// instead of a render texture each, so an edit spanning neighbouring chunks is
+// drawn under one framebuffer bind per page rather than one per chunk.
+typedef struct ChunkAtlas {
+    RenderTexture2D *pages;
+    int pageCount;
+    int maxPages;
+    int *freeSlots; // Slot = page * ATLAS_SLOTS_PER_PAGE + index within the page
+    int freeCount;
+    unsigned int binds;          // Page binds for drawing so far this frame
+    unsigned int bindsLastFrame;
+    // Slots are drawn to the screen instanced, one call per page
+    bool drawReady;
+    Shader drawShader;
+    int drawMvpLoc;
+    unsigned int drawVao;
+    unsigned int quadVbo;
+    unsigned int instanceVbo;
+    float *instances;   // World position and slot origin of each visible chunk, grouped by page
+    int *pageInstances; // Visible chunks per page this frame
+} ChunkAtlas;
+
+// --- Prefetch ---
+// Camera motion, smoothed over recent frames and extrapolated to bring chunks
+// into the pool before they scroll or zoom into view.
+typedef struct ChunkPrefetch {
+    Vector2 lastTarget;
+    float lastZoom;       // 0 until the first update
+    Vector2 velocity;     // Camera target movement per frame, in world units
+    float zoomRate;       // Zoom factor per frame
+    unsigned int hits;    // Chunks that were already resident when they came into view
+    unsigned int misses;  // Chunks loaded on the frame they came into view
+    unsigned int wasted;  // Prefetched chunks evicted before they came into view
+} ChunkPrefetch;
+
+// --- Chunk Directory ---
+// Open-addressing hash map from integer grid coordinates to the slots that
+// currently hold a chunk in each storage tier. A chunk with no tier slots has
+// no entry at all.
+typedef enum {
+    CHUNK_ENTRY_EMPTY = 0,
+    CHUNK_ENTRY_USED,
+    CHUNK_ENTRY_TOMBSTONE
+} ChunkEntryState;
+
+typedef struct ChunkEntry {
+    int x, y;
+    int poolIndex;  // Slot in canvas->chunks, or -1
+    int cacheIndex; // Slot in canvas->cache, or -1
+    int diskIndex;  // Slot in canvas->spill, or -1
+    PendingEviction *evicting; // Readback in flight, or NULL
+    int fileIndex;  // Entry in canvas->source's index, or -1
+    unsigned int dirtyGeneration; // canvas->generation of the last edit, 0 if untouched since load
+    ChunkEntryState state;
+} ChunkEntry;
+
+typedef struct ChunkDirectory {
+    ChunkEntry *entries;
+    int capacity; // Always a power of two
+    int count;    // Live entries
+    int used;     // Live entries plus tombstones
+} ChunkDirectory;
+
+// --- Level-of-detail Pyramid ---
+// Every level above 0 has CHUNK_SIZE tiles, each covering twice as many chunks
+// per side as the level below. Each level's directory lists the tiles something
+// has been drawn under; missing tiles are blank. Only tiles that have been on
+// screen are built, and they are kept in RAM up to LOD_CACHE_BUDGET_MB.
+typedef struct LodTile {
+    Image image;
+    int level, x, y;
+    unsigned int lastUsedFrame;
+} LodTile;
+
+// GPU texture showing one pyramid tile of the level being displayed
+typedef struct LodSlot {
+    Texture2D texture;
+    int level, x, y;
+    bool active;
+    bool stale; // Tile image changed since it was uploaded
+} LodSlot;
+
+typedef struct LodPyramid {
+    ChunkDirectory levels[LOD_LEVELS]; // cacheIndex -> tiles or -1 if not built, poolIndex -> slots (level 0 unused)
+    LodTile *tiles;
+    int tileCount;
+    int tileCapacity;
+    size_t tileBytes;
+    Color *scratch; // Halved chunk pixels on their way up to levels without a tile in RAM
+    LodSlot *slots;
+    int level; // Level picked from the camera zoom by Canvas_Update
+    int minX, minY, maxX, maxY; // Visible tile range at that level
+    unsigned int frame;
+    bool building; // Tiles on screen still being built
+} LodPyramid;
+
 // --- Undo/Redo Structs ---
-// Represents the state of a single chunk before a modification
+// Pixels of a tile-aligned rectangle of a chunk, read back before a stroke touched it
+// Held as a GPU texture while the undo VRAM budget allows, otherwise in RAM.
+typedef struct UndoRegion {
+    Image image;             // RAM copy, data is NULL while the region is on the GPU
+    RenderTexture2D texture; // GPU copy, id is 0 once migrated to RAM
+    int x, y;                // Top-left corner in chunk pixels
+    int width, height;
+} UndoRegion;
+
+// Represents the state of the touched parts of a single chunk before a modification
 typedef struct UndoChunkState {
-    Image beforeImage;
     Vector2 gridPos;
+    UndoRegion *regions; // In capture order; where they overlap, the earliest holds the before-state
+    int numRegions;
+    unsigned char captured[UNDO_TILES_PER_SIDE * UNDO_TILES_PER_SIDE / 8]; // One bit per tile
 } UndoChunkState;
 
 // Represents a single atomic action (like a brush stroke or text stamp)
 typedef struct UndoAction {
     UndoChunkState *chunkStates;
     int numChunks;
+    size_t bytes; // Memory held by the action, counted against UNDO_BUDGET_MB
 } UndoAction;
 
+// History stack that can also drop its oldest entry in O(1)
+typedef struct UndoRing {
+    UndoAction *items;
+    int capacity; // Power of two
+    int start;    // Index of the oldest action
+    int count;
+} UndoRing;
+
 // Manages the entire undo/redo history
 typedef struct UndoState {
-    UndoAction undoStack[MAX_UNDO_ACTIONS];
-    UndoAction redoStack[MAX_UNDO_ACTIONS];
-    int undoCount;
-    int redoCount;
+    UndoRing undo;
+    UndoRing redo;
+    size_t bytes;    // Held by both rings together
+    size_t gpuBytes; // Part of all captured regions that lives in VRAM, current action included
+    int queuedSteps; // Undos (<0) or redos (>0) waiting on chunk captures still in flight
     UndoAction *currentAction; // Action currently being recorded
 } UndoState;
 
 
+// --- GPU Readback ---
+// glReadPixels into a pixel buffer object, with a fence telling us when the
+// copy has finished so it can be mapped without stalling the pipeline.
+// Callbacks always run, with ok false if the pixels could not be read back.
+typedef void (*ReadbackCallback)(Image image, bool ok, void *userData);
+
+typedef struct ReadbackRequest {
+    unsigned int pbo;  // Created on first use, sized for a whole chunk
+    void *fence;
+    Image image;       // Destination, filled top row first
+    ReadbackCallback callback;
+    void *userData;
+    bool busy;
+} ReadbackRequest;
+
+// --- GL Extensions ---
+// rlgl doesn't expose pixel buffer objects or fences, so the few entry points
+// needed for readbacks are loaded by hand through GLFW, which raylib links.
+#if defined(_WIN32)
+    #define GLAPIENTRY __stdcall
+#else
+    #define GLAPIENTRY
+#endif
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#define GL_STREAM_READ 0x88E1
+#define GL_MAP_READ_BIT 0x0001
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#define GL_COLOR_BUFFER_BIT 0x00004000
+#define GL_NEAREST 0x2600
+#define GL_RGBA 0x1908
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_ALREADY_SIGNALED 0x911A
+#define GL_CONDITION_SATISFIED 0x911C
+#define GL_WAIT_FAILED 0x911D
+
+typedef void (*GLFWglproc)(void);
+GLFWglproc glfwGetProcAddress(const char *procname);
+
+typedef struct GLExt {
+    void (GLAPIENTRY *GenBuffers)(int n, unsigned int *buffers);
+    void (GLAPIENTRY *DeleteBuffers)(int n, const unsigned int *buffers);
+    void (GLAPIENTRY *BindBuffer)(unsigned int target, unsigned int buffer);
+    void (GLAPIENTRY *BufferData)(unsigned int target, ptrdiff_t size, const void *data, unsigned int usage);
+    void *(GLAPIENTRY *MapBufferRange)(unsigned int target, ptrdiff_t offset, ptrdiff_t length, unsigned int access);
+    unsigned char (GLAPIENTRY *UnmapBuffer)(unsigned int target);
+    void (GLAPIENTRY *BindFramebuffer)(unsigned int target, unsigned int framebuffer);
+    void (GLAPIENTRY *BlitFramebuffer)(int srcX0, int srcY0, int srcX1, int srcY1, int dstX0, int dstY0, int dstX1, int dstY1, unsigned int mask, unsigned int filter);
+    void (GLAPIENTRY *ReadPixels)(int x, int y, int width, int height, unsigned int format, unsigned int type, void *pixels);
+    void *(GLAPIENTRY *FenceSync)(unsigned int condition, unsigned int flags);
+    unsigned int (GLAPIENTRY *ClientWaitSync)(void *sync, unsigned int flags, unsigned long long timeout);
+    void (GLAPIENTRY *DeleteSync)(void *sync);
+    bool loaded;
+} GLExt;
+
+// --- Save File ---
+// v1: header, then (Vector2 gridPos, raw pixels) records until EOF.
+// v2: header, then one blob per chunk, then an index of SaveIndexEntry and a
+// SaveTrailer at the very end pointing back at it. A blob is RLE packed, or raw
+// pixels when its length is exactly CHUNK_BYTES.
+typedef struct SaveIndexEntry {
+    int32_t x, y;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t checksum; // CRC-32 of the blob
+} SaveIndexEntry;
+
+typedef struct SaveTrailer {
+    uint64_t indexOffset;
+    uint32_t count;
+    uint32_t magic; // SAVE_FILE_INDEX_MAGIC
+} SaveTrailer;
+
+typedef struct SaveWriter {
+    FILE *file;
+    long long appendStart; // Size of the file before an append, -1 for a new file
+    SaveIndexEntry *index;
+    int count;
+    int capacity;
+    unsigned char *scratch; // Encode buffer, one chunk's worth
+} SaveWriter;
+
+// The save file a canvas was loaded from. Only the index is read up front,
+// chunk payloads are fetched from the mapping the first time they are needed.
+typedef struct SaveSource {
+    char path[256];
+    FILE *file;
+    const unsigned char *map; // Whole file, read-only; NULL where mmap isn't available
+    size_t mapSize;
+    unsigned int version;
+    SaveIndexEntry *index;
+    int count;
+    uint64_t fileSize;
+    uint64_t liveBytes; // Blob bytes the index still points at
+} SaveSource;
+
+// Rewrites a save file without the blobs that later appends superseded.
+// Runs on its own thread; the result is swapped in by the main thread.
+typedef struct SaveCompaction {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool running;
+    bool finished; // Guarded by lock
+    bool ok;
+    char path[256];
+    char tempPath[264];
+    SaveIndexEntry *index; // Copy of the live index, written out in the same order
+    int count;
+    unsigned int revision; // canvas->sourceRevision the copy was taken from
+} SaveCompaction;
+
+// A save waiting on readbacks of the chunks that are resident on the GPU
+typedef struct SaveJob {
+    struct Canvas *canvas;
+    char path[256];
+    bool incremental;              // Append to path, which is the canvas's source file
+    unsigned int generation;       // Edits up to this generation are in the save
+    unsigned int savedGeneration;  // Edits up to this one are already in the file
+    Vector2 *gridPos;
+    Image *images;
+    int count;
+    int pending; // Readbacks still in flight, plus one while requests are being issued
+    bool readbackFailed; // A chunk's pixels never arrived, so nothing is written
+} SaveJob;
+
 typedef struct Canvas {
     CanvasChunk *chunks;
     int totalChunks;
+    ChunkAtlas atlas;   // GPU storage behind chunks
     CachedChunk *cache;
-    int cacheSize;
+    int cacheSize;      // Slots allocated, grows as needed
+    size_t cacheBytes;  // Pixel memory held by the cache, compressed or not
+    size_t cacheRawBytes; // What the cached chunks would take uncompressed
+    size_t cacheBudget; // Above this, least recently used chunks spill to disk
+    SpillFile spill;
+    ChunkDirectory directory; // Grid position -> pool/cache/disk slots
+    LodPyramid lod;
+    SaveSource source;
+    unsigned int sourceRevision; // Bumped whenever source is replaced
+    SaveCompaction compaction;
+    unsigned int generation;      // Current edit generation, bumped by each save
+    unsigned int savedGeneration; // Last generation fully written to source
+    unsigned int frame;
+    Rectangle view;      // World area on screen as of the last update
+    ChunkPrefetch prefetch;
+    // Canvas_Draw output for compositeCamera, kept while nothing under it changes
+    RenderTexture2D composite;
+    Camera2D compositeCamera;
+    bool compositeValid;
+    Rectangle compositeDirty; // World area changed since the composite was drawn, empty if none
     UndoState undoState; // Add undo state to the canvas
 } Canvas;
 
@@ -77,16 +432,25 @@ typedef struct TextInput {
 
 typedef struct UIState {
     Font font;
-    Texture2D colorPickerTexture;
+    Image fontAtlas; // RAM copy of font.texture, for text stamped on chunks outside the GPU pool
+    Shader pickerShader;         // Draws the picker for the selected hue, id 0 if it didn't compile
+    int pickerHueLoc;
+    int pickerSizeLoc;
+    Texture2D colorPickerTexture; // Generated on the CPU, only without pickerShader
+    float pickerHue;     // Hue colorPickerTexture was generated for
     Rectangle colorPickerRect;
     Vector3 selectedHSV; // x: hue, y: saturation, z: value
+    Color sampledPixel;  // Eyedropper readback destination
+    bool samplePending;  // sampledPixel has a readback in flight
 } UIState;
 
 //--- Canvas Module ---
 Canvas Canvas_Create(void);
 void Canvas_Update(Canvas *canvas, Camera2D camera, int screenWidth, int screenHeight);
-bool Canvas_BeginTextureMode(Canvas *canvas, Vector2 worldPos);
-void Canvas_EndTextureMode(void);
+bool Canvas_IsBusy(const Canvas *canvas);
+void Canvas_Composite(Canvas *canvas, Camera2D camera, int screenWidth, int screenHeight);
+void Canvas_PaintStroke(Canvas *canvas, Vector2 start, Vector2 end, float radius, Color color);
+void Canvas_PaintText(Canvas *canvas, Font font, Image fontAtlas, const char *text, Vector2 position, float fontSize, float spacing, Color color);
 void Canvas_Draw(Canvas canvas);
 void Canvas_Destroy(Canvas canvas);
 Vector2 WorldToGrid(Vector2 worldPos);
@@ -95,12 +459,129 @@ void Canvas_Save(Canvas *canvas, const char* path);
 void Canvas_Load(Canvas *canvas, const char* path);
 
 
+//--- GPU Readback Module ---
+bool GLExt_Load(void);
+bool GLExt_BlitRegion(RenderTexture2D src, int srcX, int srcY, RenderTexture2D dst, int dstX, int dstY, int width, int height);
+void Readback_Init(void);
+void Readback_Shutdown(void);
+void Readback_Request(RenderTexture2D target, Image image, ReadbackCallback callback, void *userData);
+void Readback_RequestRegion(RenderTexture2D target, int x, int y, Image image, ReadbackCallback callback, void *userData);
+void Readback_ReadNow(RenderTexture2D target, int x, int y, Image image);
+void Readback_Poll(void);
+void Readback_Finish(const void *pixels);
+bool Readback_IsPending(const void *pixels);
+bool Readback_Busy(void);
+size_t Readback_TotalBytes(void);
+void Readback_Cancel(const void *pixels);
+
+
+//--- Brush Module ---
+void Brush_Init(void);
+void Brush_Shutdown(void);
+void Brush_Begin(Vector2 start, Vector2 end, float radius);
+void Brush_DrawArea(Rectangle area, Vector2 offset, Color color);
+void Brush_End(void);
+
+
+//--- Raster Module ---
+int Raster_DrawCapsule(Image *image, Vector2 start, Vector2 end, float radius, Color color);
+int Raster_DrawMask(Image *image, Image mask, Rectangle source, Rectangle dest, Color color);
+void Raster_DrawText(Image *image, Font font, Image atlas, const char *text, Vector2 position, float fontSize, float spacing, Color color);
+int Raster_Benchmark(void);
+
+
+//--- Compression Module ---
+size_t Rle_Encode(const Color *pixels, int count, unsigned char *out, size_t capacity);
+bool Rle_Decode(const unsigned char *in, size_t size, Color *pixels, int count);
+void Compress_Init(void);
+void Compress_Shutdown(void);
+CompressJob *Compress_Submit(const Color *pixels, int cacheIndex);
+CompressJob *Compress_TakeFinished(void);
+void Compress_Flush(void);
+bool Compress_Busy(void);
+
+
+//--- Save File Module ---
+uint32_t Crc32(const void *data, size_t size);
+bool SaveWriter_Open(SaveWriter *writer, const char *path);
+bool SaveWriter_Append(SaveWriter *writer, const char *path);
+void SaveWriter_AddExisting(SaveWriter *writer, const SaveIndexEntry *entry);
+bool SaveWriter_AddPixels(SaveWriter *writer, int x, int y, const Color *pixels);
+bool SaveWriter_AddBlob(SaveWriter *writer, int x, int y, const unsigned char *blob, size_t length);
+bool SaveWriter_Close(SaveWriter *writer, bool keep);
+bool SaveFile_ReadHeader(FILE *file, unsigned int *version);
+bool SaveFile_ReadIndex(FILE *file, SaveIndexEntry **entries, int *count);
+unsigned char *SaveFile_ReadBlob(FILE *file, const SaveIndexEntry *entry);
+bool SaveFile_Convert(const char *inPath, const char *outPath);
+bool SaveSource_Open(SaveSource *source, const char *path);
+void SaveSource_Close(SaveSource *source);
+bool SaveSource_Fetch(SaveSource *source, int i, Color *pixels);
+bool SaveCompaction_Start(SaveCompaction *compaction, const char *path, const SaveIndexEntry *index, int count);
+bool SaveCompaction_Poll(SaveCompaction *compaction, bool wait);
+
+
+//--- Spill File Module ---
+int Spill_Write(SpillFile *spill, const void *pixels);
+bool Spill_Read(SpillFile *spill, int slot, void *pixels);
+void Spill_Free(SpillFile *spill, int slot);
+void Spill_Reset(SpillFile *spill);
+void Spill_Close(SpillFile *spill);
+
+
+//--- Chunk Atlas Module ---
+void Atlas_Init(ChunkAtlas *atlas, int slotCount);
+void Atlas_Destroy(ChunkAtlas *atlas);
+int Atlas_Acquire(ChunkAtlas *atlas);
+void Atlas_Release(ChunkAtlas *atlas, int slot);
+RenderTexture2D Atlas_Page(const ChunkAtlas *atlas, int slot);
+Vector2 Atlas_SlotOrigin(int slot);
+Rectangle Atlas_SlotSource(int slot);
+void Atlas_BeginPage(ChunkAtlas *atlas, int page);
+void Atlas_Upload(ChunkAtlas *atlas, int slot, const Color *pixels);
+void Atlas_Clear(ChunkAtlas *atlas, int slot, Color color);
+void Atlas_DrawInstances(ChunkAtlas *atlas);
+
+
+//--- Render Target Pool Module ---
+RenderTexture2D LoadColorRenderTexture(int width, int height);
+void UnloadColorRenderTexture(RenderTexture2D target);
+RenderTexture2D RenderPool_Acquire(int width, int height);
+void RenderPool_Release(RenderTexture2D target);
+size_t RenderPool_SpareBytes(void);
+size_t RenderPool_DepthBytesSaved(void);
+void RenderPool_Shutdown(void);
+
+
+//--- Chunk Directory Module ---
+void ChunkDir_Init(ChunkDirectory *dir, int capacity);
+void ChunkDir_Destroy(ChunkDirectory *dir);
+void ChunkDir_Clear(ChunkDirectory *dir);
+ChunkEntry* ChunkDir_Find(ChunkDirectory *dir, int x, int y);
+ChunkEntry* ChunkDir_Insert(ChunkDirectory *dir, int x, int y);
+void ChunkDir_RemoveIfUnused(ChunkDirectory *dir, ChunkEntry *entry);
+int ChunkDir_Benchmark(void);
+
+
+//--- LOD Pyramid Module ---
+void Lod_Init(LodPyramid *lod);
+void Lod_Clear(LodPyramid *lod);
+void Lod_Destroy(LodPyramid *lod);
+int Lod_LevelForZoom(float zoom);
+void Lod_MarkContent(LodPyramid *lod, Vector2 gridPos);
+void Lod_UpdateFromImage(LodPyramid *lod, Vector2 gridPos, Image image);
+void Lod_BuildTile(LodPyramid *lod, int level, int x, int y, const Color *chunks[4]);
+void Lod_EnforceBudget(LodPyramid *lod);
+bool Lod_UpdateResidency(LodPyramid *lod, int level, Rectangle worldView);
+
+
 //--- Undo/Redo Module ---
 void Undo_BeginAction(UndoState *undoState);
-void Undo_AddChunkToCurrentAction(Canvas *canvas, UndoState *undoState, Vector2 gridPos);
+void Undo_AddRegionToCurrentAction(Canvas *canvas, UndoState *undoState, Rectangle worldRect);
+void Undo_AddSegmentToCurrentAction(Canvas *canvas, UndoState *undoState, Vector2 start, Vector2 end, float radius);
 void Undo_EndAction(UndoState *undoState);
 void Undo_PerformUndo(Canvas *canvas, UndoState *undoState);
 void Undo_PerformRedo(Canvas *canvas, UndoState *undoState);
+void Undo_Update(Canvas *canvas, UndoState *undoState);
 void Undo_Destroy(UndoState *undoState);
 
 
@@ -108,12 +589,30 @@ void Undo_Destroy(UndoState *undoState);
 void HandleCameraControls(Camera2D *camera);
 void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool, float *brushSize, float *textSize, Color *currentColor, TextInput *textInput, UIState *ui);
 void DrawWorld(Canvas canvas, Camera2D camera, ToolType currentTool, float brushSize, float textSize, TextInput textInput, UIState ui, Color currentColor);
-void DrawUI(ToolType currentTool, UIState *ui);
+void DrawUI(ToolType currentTool, UIState *ui, const Canvas *canvas);
 Vector2 GetLocalChunkPos(Vector2 worldPos, Vector2 gridPos);
+bool CheckCollisionCapsuleRec(Vector2 start, Vector2 end, float radius, Rectangle rec);
 Image GenImageColorPicker(int width, int height, float hue);
+void InitColorPicker(UIState *ui);
+void UnloadColorPicker(UIState *ui);
 
 //--- Main Entry Point ---
-int main(void) {
+int main(int argc, char **argv) {
+    if (argc == 4 && strcmp(argv[1], "--convert") == 0) {
+        // Offline upgrade of a v1 save, no window needed
+        return SaveFile_Convert(argv[2], argv[3]) ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "--bench-raster") == 0) {
+        return Raster_Benchmark();
+    }
+    if (argc == 2 && strcmp(argv[1], "--bench-dir") == 0) {
+        return ChunkDir_Benchmark();
+    }
+    if (argc > 1) {
+        printf("Usage: %s [--convert <v1 input> <v2 output> | --bench-raster | --bench-dir]\n", argv[0]);
+        return 1;
+    }
+
     const int screenWidth = 1920;
     const int screenHeight = 1080;
 
@@ -142,9 +641,12 @@ int main(void) {
         .selectedHSV = { 0.0f, 0.0f, 0.0f } // Start with black
     };
 
-    Image colorPickerImage = GenImageColorPicker(450, 450, ui.selectedHSV.x);
-    ui.colorPickerTexture = LoadTextureFromImage(colorPickerImage);
-    UnloadImage(colorPickerImage);
+    InitColorPicker(&ui);
+
+    ui.fontAtlas = LoadImageFromTexture(ui.font.texture);
+    ImageFormat(&ui.fontAtlas, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+    Brush_Init();
 
     char filePath[256] = "canvas.dat"; // Default save path
 
@@ -152,9 +654,9 @@ int main(void) {
         camera.offset = (Vector2){ GetScreenWidth() / 2.0f, GetScreenHeight() / 2.0f };
         ui.colorPickerRect = (Rectangle){ 0, (float)GetScreenHeight() - 450, 450, 450 };
 
+        HandleCameraControls(&camera);
         Canvas_Update(&canvas, camera, GetScreenWidth(), GetScreenHeight());
 
-        HandleCameraControls(&camera);
         HandleToolAndDrawing(&canvas, camera, &currentTool, &brushSize, &textSize, &currentColor, &textInput, &ui);
 
         // Handle Save/Load
@@ -179,15 +681,25 @@ int main(void) {
         }
 
 
+        Canvas_Composite(&canvas, camera, GetScreenWidth(), GetScreenHeight());
+
         BeginDrawing();
             ClearBackground(DARKGRAY);
             DrawWorld(canvas, camera, currentTool, brushSize, textSize, textInput, ui, currentColor);
-            DrawUI(currentTool, &ui);
+            DrawUI(currentTool, &ui, &canvas);
+            // With nothing to animate or finish, the next frame waits for an input event
+            // instead of redrawing the same picture. Any event brings back full rate at once;
+            // the text cursor blinks on a timer, so typing keeps it.
+            bool buttonHeld = IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT);
+            if (Canvas_IsBusy(&canvas) || textInput.active || buttonHeld) DisableEventWaiting();
+            else EnableEventWaiting();
         EndDrawing();
     }
 
     UnloadFont(ui.font);
-    UnloadTexture(ui.colorPickerTexture);
+    UnloadImage(ui.fontAtlas);
+    UnloadColorPicker(&ui);
+    Brush_Shutdown();
     Canvas_Destroy(canvas);
     CloseWindow();
 
@@ -210,6 +722,46 @@ Image GenImageColorPicker(int width, int height, float hue) {
     return image;
 }
 
+// GenImageColorPicker on the GPU: the same per-pixel saturation, value gamma and
+// ColorFromHSV math, so the crosshair in DrawUI lines up either way
+static const char *colorPickerFragmentShader =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "uniform float hue;\n"
+    "uniform vec2 size;\n"
+    "uniform float gamma;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    vec2 pixel = min(floor(fragTexCoord * size), size - 1.0);\n"
+    "    float saturation = pixel.x / (size.x - 1.0);\n"
+    "    float value = pow(1.0 - pixel.y / (size.y - 1.0), gamma);\n"
+    "    vec3 k = mod(vec3(5.0, 3.0, 1.0) + hue / 60.0, 6.0);\n"
+    "    k = clamp(min(k, 4.0 - k), 0.0, 1.0);\n"
+    "    finalColor = vec4(value - value * saturation * k, 1.0);\n"
+    "}\n";
+
+void InitColorPicker(UIState *ui) {
+    ui->pickerShader = LoadShaderFromMemory(NULL, colorPickerFragmentShader);
+    if (ui->pickerShader.id != rlGetShaderIdDefault()) {
+        float gamma = COLOR_PICKER_GAMMA;
+        ui->pickerHueLoc = GetShaderLocation(ui->pickerShader, "hue");
+        ui->pickerSizeLoc = GetShaderLocation(ui->pickerShader, "size");
+        SetShaderValue(ui->pickerShader, GetShaderLocation(ui->pickerShader, "gamma"), &gamma, SHADER_UNIFORM_FLOAT);
+        return;
+    }
+    printf("WARNING: Colour picker shader failed to compile, the picker is generated on the CPU.\n");
+    ui->pickerShader = (Shader){ 0 };
+    Image colorPickerImage = GenImageColorPicker(450, 450, ui->selectedHSV.x);
+    ui->colorPickerTexture = LoadTextureFromImage(colorPickerImage);
+    ui->pickerHue = ui->selectedHSV.x;
+    UnloadImage(colorPickerImage);
+}
+
+void UnloadColorPicker(UIState *ui) {
+    if (ui->pickerShader.id != 0) UnloadShader(ui->pickerShader);
+    else UnloadTexture(ui->colorPickerTexture);
+}
+
 void HandleCameraControls(Camera2D *camera) {
     if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
         Vector2 delta = GetMouseDelta();
@@ -221,39 +773,44 @@ void HandleCameraControls(Camera2D *camera) {
     if (wheel != 0 && IsKeyDown(KEY_LEFT_CONTROL)) {
         Vector2 mouseWorldPosBeforeZoom = GetScreenToWorld2D(GetMousePosition(), *camera);
         camera->zoom *= (1.0f + wheel * 0.1f);
-        if (camera->zoom < 0.01f) camera->zoom = 0.01f;
+        if (camera->zoom < CAMERA_MIN_ZOOM) camera->zoom = CAMERA_MIN_ZOOM;
         Vector2 mouseWorldPosAfterZoom = GetScreenToWorld2D(GetMousePosition(), *camera);
         camera->target = Vector2Add(camera->target, Vector2Subtract(mouseWorldPosBeforeZoom, mouseWorldPosAfterZoom));
     }
 }
 
-void StampText(Canvas *canvas, Font font, TextInput *input, Color color, float textSize) {
+void StampText(Canvas *canvas, Font font, Image fontAtlas, TextInput *input, Color color, float textSize) {
     Vector2 textWorldPos = input->position;
     Vector2 measuredSize = MeasureTextEx(font, input->text, textSize, (float)textSize/BASE_FONT_SIZE);
-    Vector2 minGrid = WorldToGrid(textWorldPos);
-    Vector2 maxGrid = WorldToGrid(Vector2Add(textWorldPos, measuredSize));
 
     Undo_BeginAction(&canvas->undoState);
-    for (int y = (int)minGrid.y; y <= (int)maxGrid.y; y++) {
-        for (int x = (int)minGrid.x; x <= (int)maxGrid.x; x++) {
-            Undo_AddChunkToCurrentAction(canvas, &canvas->undoState, (Vector2){(float)x, (float)y});
-        }
-    }
+    Undo_AddRegionToCurrentAction(canvas, &canvas->undoState, (Rectangle){ textWorldPos.x, textWorldPos.y, measuredSize.x, measuredSize.y });
     Undo_EndAction(&canvas->undoState);
 
-
-    for (int y = (int)minGrid.y; y <= (int)maxGrid.y; y++) {
-        for (int x = (int)minGrid.x; x <= (int)maxGrid.x; x++) {
-            if (Canvas_BeginTextureMode(canvas, (Vector2){x * CHUNK_SIZE, y * CHUNK_SIZE})) {
-                Vector2 localPos = GetLocalChunkPos(textWorldPos, (Vector2){(float)x, (float)y});
-                DrawTextEx(font, input->text, localPos, textSize, (float)textSize/BASE_FONT_SIZE, color);
-                Canvas_EndTextureMode();
-            }
-        }
-    }
+    Canvas_PaintText(canvas, font, fontAtlas, input->text, textWorldPos, textSize, (float)textSize/BASE_FONT_SIZE, color);
     input->active = false;
 }
 
+// Regenerates the picker texture if the selected hue has moved away from it. The
+// shader picker reads the hue when drawn, so it has nothing to update.
+static void UpdateColorPicker(UIState *ui) {
+    if (ui->pickerShader.id != 0 || ui->selectedHSV.x == ui->pickerHue) return;
+    Image newPickerImage = GenImageColorPicker(ui->colorPickerTexture.width, ui->colorPickerTexture.height, ui->selectedHSV.x);
+    UpdateTexture(ui->colorPickerTexture, newPickerImage.data);
+    UnloadImage(newPickerImage);
+    ui->pickerHue = ui->selectedHSV.x;
+}
+
+// Readback callback: the pixel under the eyedropper has arrived, or failed to. Either
+// way the next sample can be asked for.
+static void EyedropperLanded(Image image, bool ok, void *userData) {
+    UIState *ui = (UIState*)userData;
+    ui->samplePending = false;
+    if (!ok) return;
+    ui->selectedHSV = ColorToHSV(*(Color*)image.data);
+    UpdateColorPicker(ui);
+}
+
 void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool, float *brushSize, float *textSize, Color *currentColor, TextInput *textInput, UIState *ui) {
     static bool isInteractingWithUI = false;
     Vector2 mousePos = GetMousePosition();
@@ -269,24 +826,21 @@ void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool
         if (IsKeyPressed(KEY_T)) *currentTool = TOOL_TEXT;
     }
 
-    if (IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) && !mouseOverUI) {
+    if (IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) && !mouseOverUI && !ui->samplePending) {
+        // One pixel per request, landing a frame or so later; the next is only asked for once it has
         Vector2 gridPos = WorldToGrid(mouseWorldPos);
-        for (int i = 0; i < canvas->totalChunks; i++) {
-            if (canvas->chunks[i].active && Vector2Equals(canvas->chunks[i].gridPos, gridPos)) {
-                Vector2 localPos = GetLocalChunkPos(mouseWorldPos, gridPos);
-                Image chunkImage = LoadImageFromTexture(canvas->chunks[i].texture.texture);
-                ImageFlipVertical(&chunkImage);
-                Color sampledColor = GetImageColor(chunkImage, (int)localPos.x, (int)localPos.y);
-                UnloadImage(chunkImage);
-
-                *currentColor = sampledColor;
-                ui->selectedHSV = ColorToHSV(sampledColor);
-
-                Image newPickerImage = GenImageColorPicker(ui->colorPickerTexture.width, ui->colorPickerTexture.height, ui->selectedHSV.x);
-                UpdateTexture(ui->colorPickerTexture, newPickerImage.data);
-                UnloadImage(newPickerImage);
-                break;
-            }
+        ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)gridPos.x, (int)gridPos.y);
+        if (entry && entry->poolIndex >= 0) {
+            Vector2 localPos = GetLocalChunkPos(mouseWorldPos, gridPos);
+            int slot = canvas->chunks[entry->poolIndex].slot;
+            Vector2 origin = Atlas_SlotOrigin(slot);
+            Image pixel = { .data = &ui->sampledPixel, .width = 1, .height = 1, .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, .mipmaps = 1 };
+            ui->samplePending = true;
+            Readback_RequestRegion(Atlas_Page(&canvas->atlas, slot), (int)(origin.x + localPos.x), (int)(origin.y + localPos.y), pixel, EyedropperLanded, ui);
+        } else if (entry == NULL) {
+            // Never drawn on, so it is background
+            ui->selectedHSV = ColorToHSV(RAYWHITE);
+            UpdateColorPicker(ui);
         }
     }
 
@@ -304,9 +858,7 @@ void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool
             ui->selectedHSV.x -= wheel * 10.0f; // Scroll Hue
             if (ui->selectedHSV.x < 0) ui->selectedHSV.x += 360;
             if (ui->selectedHSV.x >= 360) ui->selectedHSV.x -= 360;
-            Image newImage = GenImageColorPicker(ui->colorPickerTexture.width, ui->colorPickerTexture.height, ui->selectedHSV.x);
-            UpdateTexture(ui->colorPickerTexture, newImage.data);
-            UnloadImage(newImage);
+            UpdateColorPicker(ui);
         } else {
             if (*currentTool == TOOL_BRUSH) {
                 *brushSize *= (1.0f + wheel * 0.2f);
@@ -332,35 +884,8 @@ void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool
             }
 
             float radius = *brushSize / 2.0f;
-            
-            Vector2 minWorld = {
-                fminf(lastMousePos.x, mouseWorldPos.x) - radius,
-                fminf(lastMousePos.y, mouseWorldPos.y) - radius
-            };
-            Vector2 maxWorld = {
-                fmaxf(lastMousePos.x, mouseWorldPos.x) + radius,
-                fmaxf(lastMousePos.y, mouseWorldPos.y) + radius
-            };
-            Vector2 minGrid = WorldToGrid(minWorld);
-            Vector2 maxGrid = WorldToGrid(maxWorld);
-
-            for (int y = (int)minGrid.y; y <= (int)maxGrid.y; y++) {
-                for (int x = (int)minGrid.x; x <= (int)maxGrid.x; x++) {
-                    Vector2 currentGridPos = {(float)x, (float)y};
-                    Undo_AddChunkToCurrentAction(canvas, &canvas->undoState, currentGridPos);
-                    if (Canvas_BeginTextureMode(canvas, (Vector2){x * CHUNK_SIZE, y * CHUNK_SIZE})) {
-                        Vector2 localLast = GetLocalChunkPos(lastMousePos, currentGridPos);
-                        Vector2 localCurrent = GetLocalChunkPos(mouseWorldPos, currentGridPos);
-                        
-                        DrawLineEx(localLast, localCurrent, *brushSize, *currentColor);
-                        DrawCircleV(localLast, radius, *currentColor);
-                        DrawCircleV(localCurrent, radius, *currentColor);
-                        
-                        Canvas_EndTextureMode();
-                    }
-                }
-            }
-            
+            Undo_AddSegmentToCurrentAction(canvas, &canvas->undoState, lastMousePos, mouseWorldPos, radius);
+            Canvas_PaintStroke(canvas, lastMousePos, mouseWorldPos, radius, *currentColor);
             lastMousePos = mouseWorldPos;
         }
         if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
@@ -373,7 +898,7 @@ void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool
                                   IsMouseButtonDown(MOUSE_BUTTON_RIGHT);
             if (stampAndSwitch) {
                 if (IsKeyPressed(KEY_ENTER) || IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-                    StampText(canvas, ui->font, textInput, *currentColor, *textSize);
+                    StampText(canvas, ui->font, ui->fontAtlas, textInput, *currentColor, *textSize);
                 }
                 textInput->active = false;
                 *currentTool = TOOL_BRUSH;
@@ -403,8 +928,9 @@ void HandleToolAndDrawing(Canvas *canvas, Camera2D camera, ToolType *currentTool
 }
 
 void DrawWorld(Canvas canvas, Camera2D camera, ToolType currentTool, float brushSize, float textSize, TextInput textInput, UIState ui, Color currentColor) {
+    Rectangle source = { 0, 0, (float)canvas.composite.texture.width, -(float)canvas.composite.texture.height };
+    DrawTextureRec(canvas.composite.texture, source, (Vector2){ 0, 0 }, WHITE);
     BeginMode2D(camera);
-        Canvas_Draw(canvas);
         if (currentTool == TOOL_BRUSH) {
             Vector2 mouseWorldPos = GetScreenToWorld2D(GetMousePosition(), camera);
             float radius = brushSize / 2.0f;
@@ -421,8 +947,18 @@ void DrawWorld(Canvas canvas, Camera2D camera, ToolType currentTool, float brush
     EndMode2D();
 }
 
-void DrawUI(ToolType currentTool, UIState *ui) {
-    DrawTexture(ui->colorPickerTexture, ui->colorPickerRect.x, ui->colorPickerRect.y, WHITE);
+void DrawUI(ToolType currentTool, UIState *ui, const Canvas *canvas) {
+    if (ui->pickerShader.id != 0) {
+        Vector2 size = { ui->colorPickerRect.width, ui->colorPickerRect.height };
+        Texture2D white = { .id = rlGetTextureIdDefault(), .width = 1, .height = 1, .mipmaps = 1, .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        BeginShaderMode(ui->pickerShader);
+            SetShaderValue(ui->pickerShader, ui->pickerHueLoc, &ui->selectedHSV.x, SHADER_UNIFORM_FLOAT);
+            SetShaderValue(ui->pickerShader, ui->pickerSizeLoc, &size, SHADER_UNIFORM_VEC2);
+            DrawTexturePro(white, (Rectangle){ 0, 0, 1, 1 }, ui->colorPickerRect, (Vector2){ 0, 0 }, 0.0f, WHITE);
+        EndShaderMode();
+    } else {
+        DrawTexture(ui->colorPickerTexture, ui->colorPickerRect.x, ui->colorPickerRect.y, WHITE);
+    }
     DrawRectangleLinesEx(ui->colorPickerRect, 1.0f, LIGHTGRAY);
     float linearValue = powf(ui->selectedHSV.z, 1.0f / COLOR_PICKER_GAMMA);
     float crosshairX = ui->colorPickerRect.x + ui->selectedHSV.y * (ui->colorPickerRect.width -1);
@@ -436,12 +972,76 @@ void DrawUI(ToolType currentTool, UIState *ui) {
     DrawTextEx(ui->font, TextFormat("Tool: %s", toolName), (Vector2){10, 10}, 20.0f, 20.0f/BASE_FONT_SIZE, LIGHTGRAY);
     DrawTextEx(ui->font, "pan: RMB | zoom: Ctrl+scroll | size/hue: scroll", (Vector2){10, 40}, 20.0f, 20.0f/BASE_FONT_SIZE, LIGHTGRAY);
     DrawTextEx(ui->font, "undo: Ctrl+Z | redo: Ctrl+Y | save: Ctrl+S | load: Ctrl+L", (Vector2){10, 70}, 20.0f, 20.0f/BASE_FONT_SIZE, LIGHTGRAY);
+    float heldMiB = canvas->cacheBytes / (1024.0f * 1024.0f);
+    float rawMiB = canvas->cacheRawBytes / (1024.0f * 1024.0f);
+    float undoMiB = canvas->undoState.bytes / (1024.0f * 1024.0f);
+    float undoGpuMiB = canvas->undoState.gpuBytes / (1024.0f * 1024.0f);
+    float readbackMiB = Readback_TotalBytes() / (1024.0f * 1024.0f);
+    float lodMiB = canvas->lod.tileBytes / (1024.0f * 1024.0f);
+    DrawTextEx(ui->font, TextFormat("cache: %.1f MiB held / %.1f MiB raw | LOD: %.0f MiB | undo: %.1f MiB (%.1f MiB VRAM) | FBO binds: %u | read back: %.0f MiB", heldMiB, rawMiB, lodMiB, undoMiB, undoGpuMiB, canvas->atlas.bindsLastFrame, readbackMiB), (Vector2){10, 100}, 20.0f, 20.0f/BASE_FONT_SIZE, LIGHTGRAY);
+    float chunkGpuMiB = (float)canvas->atlas.pageCount * ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * sizeof(Color) / (1024.0f * 1024.0f);
+    float pooledMiB = RenderPool_SpareBytes() / (1024.0f * 1024.0f);
+    float targetsMiB = chunkGpuMiB + undoGpuMiB + pooledMiB;
+    float depthSavedMiB = RenderPool_DepthBytesSaved() / (1024.0f * 1024.0f);
+    DrawTextEx(ui->font, TextFormat("VRAM: %.0f MiB chunks + %.1f MiB undo + %.1f MiB pooled = %.0f MiB (%.0f MiB saved without depth)", chunkGpuMiB, undoGpuMiB, pooledMiB, targetsMiB, depthSavedMiB), (Vector2){10, 130}, 20.0f, 20.0f/BASE_FONT_SIZE, LIGHTGRAY);
+    const ChunkPrefetch *prefetch = &canvas->prefetch;
+    DrawTextEx(ui->font, TextFormat("prefetch: %u hits / %u misses / %u evicted unused", prefetch->hits, prefetch->misses, prefetch->wasted), (Vector2){10, 160}, 20.0f, 20.0f/BASE_FONT_SIZE, LIGHTGRAY);
 }
 
 Vector2 GetLocalChunkPos(Vector2 worldPos, Vector2 gridPos) {
     return (Vector2) { worldPos.x - gridPos.x * CHUNK_SIZE, worldPos.y - gridPos.y * CHUNK_SIZE };
 }
 
+static float PointRecDistanceSqr(Vector2 point, Rectangle rec) {
+    float dx = fmaxf(fmaxf(rec.x - point.x, 0.0f), point.x - (rec.x + rec.width));
+    float dy = fmaxf(fmaxf(rec.y - point.y, 0.0f), point.y - (rec.y + rec.height));
+    return dx * dx + dy * dy;
+}
+
+static float PointSegmentDistanceSqr(Vector2 point, Vector2 start, Vector2 end) {
+    Vector2 axis = Vector2Subtract(end, start);
+    float lengthSqr = Vector2DotProduct(axis, axis);
+    float t = (lengthSqr > 0.0f) ? Clamp(Vector2DotProduct(Vector2Subtract(point, start), axis) / lengthSqr, 0.0f, 1.0f) : 0.0f;
+    Vector2 closest = Vector2Add(start, Vector2Scale(axis, t));
+    Vector2 d = Vector2Subtract(point, closest);
+    return d.x * d.x + d.y * d.y;
+}
+
+// Whether the segment passes through rec (Liang-Barsky clipping)
+static bool CheckCollisionSegmentRec(Vector2 start, Vector2 end, Rectangle rec) {
+    float t0 = 0.0f, t1 = 1.0f;
+    float dx = end.x - start.x, dy = end.y - start.y;
+    float p[4] = { -dx, dx, -dy, dy };
+    float q[4] = { start.x - rec.x, rec.x + rec.width - start.x, start.y - rec.y, rec.y + rec.height - start.y };
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0f) {
+            if (q[i] < 0.0f) return false;
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0.0f) t0 = fmaxf(t0, t);
+        else t1 = fminf(t1, t);
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+// Whether the capsule swept by a circle of radius from start to end overlaps rec. Apart
+// from the segment crossing rec, the closest approach is at a segment end or a corner.
+bool CheckCollisionCapsuleRec(Vector2 start, Vector2 end, float radius, Rectangle rec) {
+    if (CheckCollisionSegmentRec(start, end, rec)) return true;
+    float radiusSqr = radius * radius;
+    if (PointRecDistanceSqr(start, rec) <= radiusSqr || PointRecDistanceSqr(end, rec) <= radiusSqr) return true;
+    Vector2 corners[4] = {
+        { rec.x, rec.y }, { rec.x + rec.width, rec.y },
+        { rec.x, rec.y + rec.height }, { rec.x + rec.width, rec.y + rec.height }
+    };
+    for (int i = 0; i < 4; i++) {
+        if (PointSegmentDistanceSqr(corners[i], start, end) <= radiusSqr) return true;
+    }
+    return false;
+}
+
 //--- Canvas Implementations ---
 
 Vector2 WorldToGrid(Vector2 worldPos) {
@@ -454,416 +1054,3428 @@ Canvas Canvas_Create(void) {
     canvas.totalChunks = diameter * diameter;
     canvas.chunks = (CanvasChunk*)malloc(sizeof(CanvasChunk) * canvas.totalChunks);
     for (int i = 0; i < canvas.totalChunks; i++) canvas.chunks[i].active = false;
-    canvas.cacheSize = MAX_CACHED_CHUNKS;
+    // Evicted chunks keep their slot until read back, and no more of those are in flight
+    // than there are pixel buffers, so with this headroom a slot is always free
+    Atlas_Init(&canvas.atlas, canvas.totalChunks + READBACK_MAX_BUFFERS);
+    canvas.cacheSize = 64;
     canvas.cache = (CachedChunk*)malloc(sizeof(CachedChunk) * canvas.cacheSize);
     for (int i = 0; i < canvas.cacheSize; i++) canvas.cache[i].active = false;
+    canvas.cacheBudget = (size_t)CPU_CACHE_BUDGET_MB * 1024 * 1024;
+    canvas.generation = 1;
+    Readback_Init();
+    Compress_Init();
+    ChunkDir_Init(&canvas.directory, (canvas.totalChunks + canvas.cacheSize) * 2);
+    Lod_Init(&canvas.lod);
     
     // Initialize UndoState
-    canvas.undoState.undoCount = 0;
-    canvas.undoState.redoCount = 0;
-    canvas.undoState.currentAction = NULL;
+    canvas.undoState = (UndoState){0};
 
-    printf("Canvas created with GPU pool for %d chunks and CPU cache for %d chunks.\n", canvas.totalChunks, canvas.cacheSize);
+    printf("Canvas created with GPU pool for %d chunks, a %d MiB CPU cache and %d MiB of undo.\n", canvas.totalChunks, CPU_CACHE_BUDGET_MB, UNDO_BUDGET_MB);
     return canvas;
 }
 
-CanvasChunk* GetAndActivateChunk(Canvas *canvas, Vector2 gridPos) {
-    for (int i = 0; i < canvas->totalChunks; i++) {
-        if (canvas->chunks[i].active && Vector2Equals(canvas->chunks[i].gridPos, gridPos)) return &canvas->chunks[i];
+static Image AllocChunkImage(void) {
+    return (Image){
+        .data = malloc(CHUNK_BYTES),
+        .width = CHUNK_SIZE,
+        .height = CHUNK_SIZE,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        .mipmaps = 1
+    };
+}
+
+// Fills pixels with the contents of a cached chunk, unpacking it if needed
+static bool Cache_ReadPixels(const CachedChunk *cached, void *pixels) {
+    if (cached->image.data) {
+        memcpy(pixels, cached->image.data, CHUNK_BYTES);
+        return true;
     }
-    for (int i = 0; i < canvas->totalChunks; i++) {
-        if (!canvas->chunks[i].active) {
-            CanvasChunk *newChunk = &canvas->chunks[i];
-            newChunk->active = true;
-            newChunk->gridPos = gridPos;
-            newChunk->modified = false;
-            for (int j = 0; j < canvas->cacheSize; j++) {
-                if (canvas->cache[j].active && Vector2Equals(canvas->cache[j].gridPos, gridPos)) {
-                    printf("Loading chunk (%.0f, %.0f) from cache.\n", gridPos.x, gridPos.y);
-                    Texture2D tex = LoadTextureFromImage(canvas->cache[j].image);
-                    newChunk->texture = LoadRenderTexture(tex.width, tex.height);
-                    BeginTextureMode(newChunk->texture);
-                        DrawTexture(tex, 0, 0, WHITE);
-                    EndTextureMode();
-                    UnloadTexture(tex);
-                    UnloadImage(canvas->cache[j].image);
-                    canvas->cache[j].active = false;
-                    newChunk->modified = true;
-                    return newChunk;
-                }
+    return Rle_Decode(cached->packed, cached->packedSize, (Color*)pixels, CHUNK_SIZE * CHUNK_SIZE);
+}
+
+// Frees a cache slot. Raw pixels still being compressed are left to the worker's result.
+static void Cache_Release(Canvas *canvas, int index) {
+    CachedChunk *cached = &canvas->cache[index];
+    if (cached->job) {
+        cached->job->orphaned = true;
+    } else if (cached->image.data) {
+        UnloadImage(cached->image);
+    }
+    free(cached->packed);
+    canvas->cacheBytes -= cached->image.data ? CHUNK_BYTES : cached->packedSize;
+    canvas->cacheRawBytes -= CHUNK_BYTES;
+    *cached = (CachedChunk){0};
+}
+
+// Swaps raw pixels for their compressed form as the worker finishes them
+static void Cache_CollectCompressed(Canvas *canvas) {
+    CompressJob *job = Compress_TakeFinished();
+    while (job) {
+        CompressJob *next = job->next;
+        if (job->orphaned) {
+            free((void*)job->pixels);
+            free(job->packed);
+        } else {
+            CachedChunk *cached = &canvas->cache[job->cacheIndex];
+            cached->job = NULL;
+            if (job->packed) {
+                UnloadImage(cached->image);
+                cached->image.data = NULL;
+                cached->packed = job->packed;
+                cached->packedSize = job->packedSize;
+                canvas->cacheBytes -= CHUNK_BYTES - job->packedSize;
             }
-            printf("Creating new blank chunk at (%.0f, %.0f).\n", gridPos.x, gridPos.y);
-            newChunk->texture = LoadRenderTexture(CHUNK_SIZE, CHUNK_SIZE);
-            BeginTextureMode(newChunk->texture);
-                ClearBackground(RAYWHITE);
-            EndTextureMode();
-            return newChunk;
         }
+        free(job);
+        job = next;
     }
-    return NULL;
 }
 
-void Canvas_Update(Canvas *canvas, Camera2D camera, int screenWidth, int screenHeight) {
-    Vector2 tl = GetScreenToWorld2D((Vector2){0, 0}, camera);
-    Vector2 tr = GetScreenToWorld2D((Vector2){(float)screenWidth, 0}, camera);
-    Vector2 bl = GetScreenToWorld2D((Vector2){0, (float)screenHeight}, camera);
-    Vector2 br = GetScreenToWorld2D((Vector2){(float)screenWidth, (float)screenHeight}, camera);
-    float minWorldX = fminf(fminf(tl.x, tr.x), fminf(bl.x, br.x));
-    float minWorldY = fminf(fminf(tl.y, tr.y), fminf(bl.y, br.y));
-    float maxWorldX = fmaxf(fmaxf(tl.x, tr.x), fmaxf(bl.x, br.x));
-    float maxWorldY = fmaxf(fmaxf(tl.y, tr.y), fmaxf(bl.y, br.y));
-    Vector2 minGrid = WorldToGrid((Vector2){minWorldX, minWorldY});
-    Vector2 maxGrid = WorldToGrid((Vector2){maxWorldX, maxWorldY});
-    int minX = (int)minGrid.x - CHUNK_LOAD_PADDING;
-    int minY = (int)minGrid.y - CHUNK_LOAD_PADDING;
-    int maxX = (int)maxGrid.x + CHUNK_LOAD_PADDING;
-    int maxY = (int)maxGrid.y + CHUNK_LOAD_PADDING;
+// Moves the least recently used RAM chunks to the spill file until the cache fits its budget.
+// Chunks still with the compressor are about to shrink, so rather than wait for them the
+// budget may overshoot by their raw size; they are not spilled, and count once collected.
+// Chunks being painted on in RAM count like any other, but not those edited this frame,
+// which callers may still be drawing into.
+static void Cache_EnforceBudget(Canvas *canvas) {
+    Cache_CollectCompressed(canvas);
+    if (canvas->cacheBytes <= canvas->cacheBudget) return;
+    size_t compressing = 0;
+    for (int i = 0; i < canvas->cacheSize; i++) {
+        if (canvas->cache[i].active && canvas->cache[i].job) compressing += CHUNK_BYTES;
+    }
+    Image buffer = { 0 };
+    while (canvas->cacheBytes > canvas->cacheBudget + compressing) {
+        int victim = -1;
+        for (int i = 0; i < canvas->cacheSize; i++) {
+            if (!canvas->cache[i].active || canvas->cache[i].job) continue;
+            if (canvas->cache[i].editing && canvas->cache[i].lastUsedFrame == canvas->frame) continue;
+            if (victim < 0 || canvas->cache[i].lastUsedFrame < canvas->cache[victim].lastUsedFrame) victim = i;
+        }
+        if (victim < 0) return;
 
-    for (int i = 0; i < canvas->totalChunks; i++) {
-        if (canvas->chunks[i].active) {
-            Vector2 pos = canvas->chunks[i].gridPos;
-            if (pos.x < minX || pos.x > maxX || pos.y < minY || pos.y > maxY) {
-                if (canvas->chunks[i].modified) {
-                    bool cached = false;
-                    for (int j = 0; j < canvas->cacheSize; j++) {
-                        if (!canvas->cache[j].active) {
-                            printf("Caching modified chunk (%.0f, %.0f).\n", pos.x, pos.y);
-                            Image img = LoadImageFromTexture(canvas->chunks[i].texture.texture);
-                            ImageFlipVertical(&img);
-                            canvas->cache[j].image = img;
-                            canvas->cache[j].gridPos = pos;
-                            canvas->cache[j].active = true;
-                            cached = true;
-                            break;
-                        }
-                    }
-                    if (!cached) printf("WARNING: CPU cache is full! Could not save chunk (%.0f, %.0f).\n", pos.x, pos.y);
-                }
-                UnloadRenderTexture(canvas->chunks[i].texture);
-                canvas->chunks[i].active = false;
-            }
+        CachedChunk *cached = &canvas->cache[victim];
+        ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)cached->gridPos.x, (int)cached->gridPos.y);
+        if (entry->poolIndex >= 0) {
+            // Clean copy of a resident chunk: cheaper to read it back if it is ever evicted than to spill it now
+            canvas->chunks[entry->poolIndex].modified = true;
+            entry->cacheIndex = -1;
+            Cache_Release(canvas, victim);
+            continue;
         }
-    }
-    for (int y = minY; y <= maxY; y++) {
-        for (int x = minX; x <= maxX; x++) {
-            GetAndActivateChunk(canvas, (Vector2){(float)x, (float)y});
+        if (cached->lodDirty) Lod_UpdateFromImage(&canvas->lod, cached->gridPos, cached->image);
+        const void *pixels = cached->image.data;
+        if (pixels == NULL) {
+            if (buffer.data == NULL) buffer = AllocChunkImage();
+            Cache_ReadPixels(cached, buffer.data);
+            pixels = buffer.data;
         }
+        int slot = Spill_Write(&canvas->spill, pixels);
+        if (slot < 0) {
+            printf("WARNING: Could not spill chunk (%.0f, %.0f) to disk, keeping it in RAM.\n", cached->gridPos.x, cached->gridPos.y);
+            break;
+        }
+        entry->cacheIndex = -1;
+        entry->diskIndex = slot;
+        Cache_Release(canvas, victim);
     }
+    if (buffer.data) UnloadImage(buffer);
 }
 
-bool Canvas_BeginTextureMode(Canvas *canvas, Vector2 worldPos) {
-    CanvasChunk *chunk = GetAndActivateChunk(canvas, WorldToGrid(worldPos));
-    if (chunk != NULL) {
-        BeginTextureMode(chunk->texture);
-        chunk->modified = true;
-        return true;
+// Finds a free cache slot for the chunk behind entry, growing the array if needed
+static CachedChunk *Cache_Insert(Canvas *canvas, ChunkEntry *entry, Vector2 gridPos) {
+    int slot = -1;
+    for (int i = 0; i < canvas->cacheSize; i++) {
+        if (!canvas->cache[i].active) { slot = i; break; }
     }
-    fprintf(stderr, "WARNING: Could not activate chunk for drawing at (%.2f, %.2f).\n", worldPos.x, worldPos.y);
-    return false;
+    if (slot < 0) {
+        slot = canvas->cacheSize;
+        canvas->cacheSize *= 2;
+        canvas->cache = (CachedChunk*)realloc(canvas->cache, sizeof(CachedChunk) * canvas->cacheSize);
+        for (int i = slot; i < canvas->cacheSize; i++) canvas->cache[i].active = false;
+    }
+    canvas->cache[slot] = (CachedChunk){ .gridPos = gridPos, .active = true, .lastUsedFrame = canvas->frame };
+    entry->cacheIndex = slot;
+    canvas->cacheRawBytes += CHUNK_BYTES;
+    return &canvas->cache[slot];
 }
 
-void Canvas_EndTextureMode(void) {
-    EndTextureMode();
+// Takes ownership of image as the RAM copy of the chunk behind entry
+static void Cache_Store(Canvas *canvas, ChunkEntry *entry, Vector2 gridPos, Image image) {
+    CachedChunk *cached = Cache_Insert(canvas, entry, gridPos);
+    cached->image = image;
+    cached->job = Compress_Submit((const Color*)image.data, entry->cacheIndex);
+    canvas->cacheBytes += CHUNK_BYTES;
+    Cache_EnforceBudget(canvas);
 }
 
-void Canvas_Draw(Canvas canvas) {
-    for (int i = 0; i < canvas.totalChunks; i++) {
-        if (canvas.chunks[i].active) {
-            Vector2 chunkTopLeft = { canvas.chunks[i].gridPos.x * CHUNK_SIZE, canvas.chunks[i].gridPos.y * CHUNK_SIZE };
-            DrawTextureRec(canvas.chunks[i].texture.texture, (Rectangle){ 0, 0, (float)CHUNK_SIZE, -(float)CHUNK_SIZE }, chunkTopLeft, WHITE);
-        }
+// Brings a chunk outside the GPU pool into the cache as raw pixels that can be painted
+// on in place, from whichever tier holds it. It stays raw until the edits settle.
+static CachedChunk *Cache_Edit(Canvas *canvas, Vector2 gridPos) {
+    ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)gridPos.x, (int)gridPos.y);
+    if (entry && entry->evicting) {
+        // Only just evicted, and the pool had nothing to give up for it this frame (see
+        // Canvas_ResidentChunk): wait for its pixels to land in the cache
+        Readback_Finish(entry->evicting->pixels);
+    }
+    entry = ChunkDir_Insert(&canvas->directory, (int)gridPos.x, (int)gridPos.y);
+    if (entry->cacheIndex >= 0 && canvas->cache[entry->cacheIndex].editing) {
+        canvas->cache[entry->cacheIndex].lastUsedFrame = canvas->frame;
+        return &canvas->cache[entry->cacheIndex];
     }
-}
 
-void Canvas_Destroy(Canvas canvas) {
-    for (int i = 0; i < canvas.totalChunks; i++) {
-        if (canvas.chunks[i].active) UnloadRenderTexture(canvas.chunks[i].texture);
+    Image image = AllocChunkImage();
+    bool loaded = false;
+    if (entry->cacheIndex >= 0) {
+        // The compressor may still be reading the raw copy, so edits go to a private one
+        loaded = Cache_ReadPixels(&canvas->cache[entry->cacheIndex], image.data);
+        if (!loaded) printf("ERROR: Cached chunk (%.0f, %.0f) is corrupt.\n", gridPos.x, gridPos.y);
+        Cache_Release(canvas, entry->cacheIndex);
+        entry->cacheIndex = -1;
+    } else if (entry->diskIndex >= 0) {
+        loaded = Spill_Read(&canvas->spill, entry->diskIndex, image.data);
+        Spill_Free(&canvas->spill, entry->diskIndex);
+        entry->diskIndex = -1;
+        if (!loaded) printf("ERROR: Could not read chunk (%.0f, %.0f) back from the spill file.\n", gridPos.x, gridPos.y);
+    } else if (entry->fileIndex >= 0) {
+        loaded = SaveSource_Fetch(&canvas->source, entry->fileIndex, (Color*)image.data);
+        if (!loaded) {
+            printf("ERROR: Chunk (%.0f, %.0f) is damaged in the save file.\n", gridPos.x, gridPos.y);
+            entry->fileIndex = -1;
+        }
     }
-    free(canvas.chunks);
-    for (int i = 0; i < canvas.cacheSize; i++) {
-        if (canvas.cache[i].active) UnloadImage(canvas.cache[i].image);
+    if (!loaded) {
+        Color *pixels = (Color*)image.data;
+        for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) pixels[i] = RAYWHITE;
     }
-    free(canvas.cache);
-    Undo_Destroy(&canvas.undoState);
-}
 
-void Canvas_Save(Canvas *canvas, const char* path) {
-    FILE *file = fopen(path, "wb");
-    if (!file) {
-        printf("ERROR: Could not open file '%s' for writing.\n", path);
-        return;
-    }
+    CachedChunk *cached = Cache_Insert(canvas, entry, gridPos);
+    cached->image = image;
+    cached->editing = true;
+    canvas->cacheBytes += CHUNK_BYTES;
+    Cache_EnforceBudget(canvas); // Spares chunks edited this frame, this one included
+    return cached;
+}
 
-    // Write header
-    unsigned int magic = SAVE_FILE_MAGIC;
-    unsigned int version = SAVE_FILE_VERSION;
-    fwrite(&magic, sizeof(unsigned int), 1, file);
-    fwrite(&version, sizeof(unsigned int), 1, file);
+// Flags a chunk painted on in RAM, for the LOD pyramid and the next save
+static void Cache_MarkDirty(Canvas *canvas, CachedChunk *cached) {
+    cached->lodDirty = true;
+    ChunkDir_Find(&canvas->directory, (int)cached->gridPos.x, (int)cached->gridPos.y)->dirtyGeneration = canvas->generation;
+}
 
-    // Save active chunks
-    for (int i = 0; i < canvas->totalChunks; i++) {
-        if (canvas->chunks[i].active && canvas->chunks[i].modified) {
-            Image img = LoadImageFromTexture(canvas->chunks[i].texture.texture);
-            ImageFlipVertical(&img);
-            fwrite(&canvas->chunks[i].gridPos, sizeof(Vector2), 1, file);
-            fwrite(img.data, sizeof(Color), CHUNK_SIZE * CHUNK_SIZE, file);
-            UnloadImage(img);
+// Shows RAM edits in the pyramid once per frame and compresses chunks nobody paints on anymore
+static void Cache_SettleEdits(Canvas *canvas) {
+    bool settled = false;
+    for (int i = 0; i < canvas->cacheSize; i++) {
+        CachedChunk *cached = &canvas->cache[i];
+        if (!cached->active || !cached->editing) continue;
+        if (cached->lodDirty) {
+            Lod_UpdateFromImage(&canvas->lod, cached->gridPos, cached->image);
+            cached->lodDirty = false;
+        }
+        if (canvas->frame - cached->lastUsedFrame > CACHE_EDIT_SETTLE_FRAMES) {
+            cached->editing = false;
+            cached->job = Compress_Submit((const Color*)cached->image.data, i);
+            settled = true;
         }
     }
-    // Save cached chunks
-    for (int i = 0; i < canvas->cacheSize; i++) {
-        if (canvas->cache[i].active) {
-            fwrite(&canvas->cache[i].gridPos, sizeof(Vector2), 1, file);
-            fwrite(canvas->cache[i].image.data, sizeof(Color), CHUNK_SIZE * CHUNK_SIZE, file);
+    if (settled) Cache_EnforceBudget(canvas);
+}
+
+// Readback callback: the pixels of an evicted chunk have arrived
+static void Canvas_FinishEviction(Image image, bool ok, void *userData) {
+    PendingEviction *pending = (PendingEviction*)userData;
+    if (pending->cancelled) {
+        UnloadImage(image);
+    } else {
+        Canvas *canvas = pending->canvas;
+        if (!ok) {
+            // The slot is still held, so its pixels can be read again the slow way
+            printf("WARNING: Reading chunk (%.0f, %.0f) back again without a pixel buffer.\n", pending->gridPos.x, pending->gridPos.y);
+            Vector2 origin = Atlas_SlotOrigin(pending->slot);
+            Readback_ReadNow(Atlas_Page(&canvas->atlas, pending->slot), (int)origin.x, (int)origin.y, image);
         }
+        ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)pending->gridPos.x, (int)pending->gridPos.y);
+        entry->evicting = NULL;
+        if (pending->lodDirty) Lod_UpdateFromImage(&canvas->lod, pending->gridPos, image);
+        Atlas_Release(&canvas->atlas, pending->slot);
+        Cache_Store(canvas, entry, pending->gridPos, image);
     }
+    free(pending);
+}
 
-    fclose(file);
-    printf("Canvas saved to '%s'\n", path);
+// Drops every eviction still in flight, along with its atlas slot
+static void Canvas_CancelEvictions(Canvas *canvas) {
+    for (int i = 0; i < canvas->directory.capacity; i++) {
+        ChunkEntry *entry = &canvas->directory.entries[i];
+        if (entry->state != CHUNK_ENTRY_USED || entry->evicting == NULL) continue;
+        Atlas_Release(&canvas->atlas, entry->evicting->slot);
+        entry->evicting->cancelled = true;
+        entry->evicting = NULL;
+    }
 }
 
-void Canvas_Load(Canvas *canvas, const char* path) {
-    FILE *file = fopen(path, "rb");
-    if (!file) {
-        printf("ERROR: Could not open file '%s' for reading.\n", path);
+// Marks a world area for redrawing into the composite
+static void Canvas_Invalidate(Canvas *canvas, Rectangle area) {
+    Rectangle *dirty = &canvas->compositeDirty;
+    if (dirty->width <= 0.0f || dirty->height <= 0.0f) {
+        *dirty = area;
         return;
     }
+    float minX = fminf(dirty->x, area.x), minY = fminf(dirty->y, area.y);
+    float maxX = fmaxf(dirty->x + dirty->width, area.x + area.width);
+    float maxY = fmaxf(dirty->y + dirty->height, area.y + area.height);
+    *dirty = (Rectangle){ minX, minY, maxX - minX, maxY - minY };
+}
 
-    // Read and verify header
-    unsigned int magic;
-    unsigned int version;
-    fread(&magic, sizeof(unsigned int), 1, file);
-    fread(&version, sizeof(unsigned int), 1, file);
+static Rectangle ChunkRect(Vector2 gridPos) {
+    return (Rectangle){ gridPos.x * CHUNK_SIZE, gridPos.y * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
+}
 
-    if (magic != SAVE_FILE_MAGIC || version != SAVE_FILE_VERSION) {
-        printf("ERROR: Invalid save file format or version.\n");
-        fclose(file);
-        return;
+// Moves a resident chunk out of the GPU pool, keeping its pixels if it was drawn on.
+// The pool slot is free right away; the pixels reach the cache a frame or two later.
+static void Canvas_EvictChunk(Canvas *canvas, int index) {
+    CanvasChunk *chunk = &canvas->chunks[index];
+    Vector2 pos = chunk->gridPos;
+    ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)pos.x, (int)pos.y);
+    if (chunk->prefetched) canvas->prefetch.wasted++;
+    if (chunk->modified) {
+        printf("Caching modified chunk (%.0f, %.0f).\n", pos.x, pos.y);
+        PendingEviction *pending = (PendingEviction*)malloc(sizeof(PendingEviction));
+        Image image = AllocChunkImage();
+        *pending = (PendingEviction){ .canvas = canvas, .gridPos = pos, .slot = chunk->slot, .pixels = image.data, .lodDirty = chunk->lodDirty };
+        entry->evicting = pending;
+        Vector2 origin = Atlas_SlotOrigin(chunk->slot);
+        Readback_RequestRegion(Atlas_Page(&canvas->atlas, chunk->slot), (int)origin.x, (int)origin.y, image, Canvas_FinishEviction, pending);
+    } else {
+        Atlas_Release(&canvas->atlas, chunk->slot);
     }
+    chunk->active = false;
+    entry->poolIndex = -1;
+    ChunkDir_RemoveIfUnused(&canvas->directory, entry);
+    Canvas_Invalidate(canvas, ChunkRect(pos)); // Zoomed out, the LOD tile shows through again
+}
 
-    // Clear existing canvas state
+CanvasChunk* GetAndActivateChunk(Canvas *canvas, Vector2 gridPos) {
+    ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)gridPos.x, (int)gridPos.y);
+    if (entry && entry->poolIndex >= 0) {
+        canvas->chunks[entry->poolIndex].lastUsedFrame = canvas->frame;
+        return &canvas->chunks[entry->poolIndex];
+    }
+
+    int slot = -1;
     for (int i = 0; i < canvas->totalChunks; i++) {
-        if (canvas->chunks[i].active) {
-            UnloadRenderTexture(canvas->chunks[i].texture);
-            canvas->chunks[i].active = false;
-        }
+        if (!canvas->chunks[i].active) { slot = i; break; }
     }
-    for (int i = 0; i < canvas->cacheSize; i++) {
-        if (canvas->cache[i].active) {
-            UnloadImage(canvas->cache[i].image);
-            canvas->cache[i].active = false;
+    if (slot < 0) {
+        // Pool is full: evict the least recently used chunk that this frame hasn't touched
+        for (int i = 0; i < canvas->totalChunks; i++) {
+            if (canvas->chunks[i].lastUsedFrame == canvas->frame) continue;
+            if (slot < 0 || canvas->chunks[i].lastUsedFrame < canvas->chunks[slot].lastUsedFrame) slot = i;
         }
+        if (slot < 0) return NULL;
+        Canvas_EvictChunk(canvas, slot);
     }
-    Undo_Destroy(&canvas->undoState);
-    canvas->undoState = (UndoState){0};
-
 
-    // Load chunks into cache
-    int cacheIndex = 0;
-    while (!feof(file) && cacheIndex < canvas->cacheSize) {
-        Vector2 gridPos;
-        if (fread(&gridPos, sizeof(Vector2), 1, file) != 1) break;
-
-        Image img = {
-            .data = malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(Color)),
-            .width = CHUNK_SIZE,
-            .height = CHUNK_SIZE,
-            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
-            .mipmaps = 1
-        };
-        fread(img.data, sizeof(Color), CHUNK_SIZE * CHUNK_SIZE, file);
-        
-        canvas->cache[cacheIndex].image = img;
-        canvas->cache[cacheIndex].gridPos = gridPos;
-        canvas->cache[cacheIndex].active = true;
-        cacheIndex++;
+    CanvasChunk *newChunk = &canvas->chunks[slot];
+    newChunk->active = true;
+    newChunk->gridPos = gridPos;
+    newChunk->modified = false;
+    newChunk->lodDirty = false;
+    newChunk->prefetched = false;
+    newChunk->lastUsedFrame = canvas->frame;
+    Canvas_Invalidate(canvas, ChunkRect(gridPos));
+    // Insert may grow the table, so re-fetch the entry through it
+    entry = ChunkDir_Insert(&canvas->directory, (int)gridPos.x, (int)gridPos.y);
+    entry->poolIndex = slot;
+    if (entry->evicting) {
+        // Still on the GPU: take the slot back and let the readback go to waste
+        newChunk->slot = entry->evicting->slot;
+        newChunk->modified = true;
+        newChunk->lodDirty = entry->evicting->lodDirty;
+        entry->evicting->cancelled = true;
+        entry->evicting = NULL;
+        return newChunk;
     }
-
-    fclose(file);
-    printf("Canvas loaded from '%s'\n", path);
-}
-
-
-//--- Undo/Redo Implementations ---
-
-void Undo_BeginAction(UndoState *undoState) {
-    if (undoState->currentAction != NULL) {
-        // This case should ideally not happen if EndAction is always called.
-        // But as a safeguard, we can end the previous action.
-        Undo_EndAction(undoState);
+    newChunk->slot = Atlas_Acquire(&canvas->atlas);
+    if (newChunk->slot < 0) {
+        printf("WARNING: No atlas slot free for chunk (%.0f, %.0f).\n", gridPos.x, gridPos.y);
+        newChunk->active = false;
+        entry->poolIndex = -1;
+        ChunkDir_RemoveIfUnused(&canvas->directory, entry);
+        return NULL;
     }
-    undoState->currentAction = (UndoAction*)calloc(1, sizeof(UndoAction));
+    if (entry->cacheIndex >= 0) {
+        CachedChunk *cached = &canvas->cache[entry->cacheIndex];
+        printf("Loading chunk (%.0f, %.0f) from cache.\n", gridPos.x, gridPos.y);
+        Image img = cached->image;
+        if (img.data == NULL) {
+            img = AllocChunkImage();
+            if (!Cache_ReadPixels(cached, img.data)) printf("ERROR: Cached chunk (%.0f, %.0f) is corrupt.\n", gridPos.x, gridPos.y);
+        }
+        Atlas_Upload(&canvas->atlas, newChunk->slot, (const Color*)img.data);
+        if (img.data != cached->image.data) UnloadImage(img);
+        // The cached copy stays as a clean copy: evicting the chunk unchanged costs no readback
+        newChunk->lodDirty = cached->lodDirty;
+        cached->lastUsedFrame = canvas->frame;
+        return newChunk;
+    }
+    if (entry->diskIndex >= 0) {
+        printf("Loading chunk (%.0f, %.0f) from disk.\n", gridPos.x, gridPos.y);
+        Image img = AllocChunkImage();
+        bool loaded = Spill_Read(&canvas->spill, entry->diskIndex, img.data);
+        if (loaded) {
+            // Likewise the spill slot, which saves both the readback and a rewrite
+            Atlas_Upload(&canvas->atlas, newChunk->slot, (const Color*)img.data);
+            UnloadImage(img);
+            return newChunk;
+        }
+        Spill_Free(&canvas->spill, entry->diskIndex);
+        entry->diskIndex = -1;
+        UnloadImage(img);
+        printf("ERROR: Could not read chunk (%.0f, %.0f) back from the spill file.\n", gridPos.x, gridPos.y);
+    }
+    if (entry->fileIndex >= 0) {
+        // Untouched since load: the save file still has it, so it can be dropped again on eviction
+        Image img = AllocChunkImage();
+        bool loaded = SaveSource_Fetch(&canvas->source, entry->fileIndex, (Color*)img.data);
+        if (loaded) Atlas_Upload(&canvas->atlas, newChunk->slot, (const Color*)img.data);
+        UnloadImage(img);
+        if (loaded) return newChunk;
+        printf("ERROR: Chunk (%.0f, %.0f) is damaged in the save file.\n", gridPos.x, gridPos.y);
+        entry->fileIndex = -1;
+    }
+    printf("Creating new blank chunk at (%.0f, %.0f).\n", gridPos.x, gridPos.y);
+    Atlas_Clear(&canvas->atlas, newChunk->slot, RAYWHITE);
+    return newChunk;
 }
 
-void Undo_AddChunkToCurrentAction(Canvas *canvas, UndoState *undoState, Vector2 gridPos) {
-    if (undoState->currentAction == NULL) return;
+// Makes the save file at path the canvas's source, e.g. after writing every chunk to it
+static bool Canvas_AdoptSource(Canvas *canvas, const char *path) {
+    SaveSource_Close(&canvas->source);
+    canvas->sourceRevision++;
+    for (int i = 0; i < canvas->directory.capacity; i++) canvas->directory.entries[i].fileIndex = -1;
 
-    // Check if we've already stored the "before" state for this chunk in this action
-    for (int i = 0; i < undoState->currentAction->numChunks; i++) {
-        if (Vector2Equals(undoState->currentAction->chunkStates[i].gridPos, gridPos)) {
-            return; // Already saved
+    bool ok = SaveSource_Open(&canvas->source, path);
+    if (ok) {
+        for (int i = 0; i < canvas->source.count; i++) {
+            ChunkEntry *entry = ChunkDir_Insert(&canvas->directory, canvas->source.index[i].x, canvas->source.index[i].y);
+            if (entry->fileIndex < 0) entry->fileIndex = i;
+            Lod_MarkContent(&canvas->lod, (Vector2){ (float)entry->x, (float)entry->y });
         }
+    } else {
+        printf("ERROR: Could not reopen '%s', chunks not edited since load are lost.\n", path);
     }
-
-    CanvasChunk* chunk = GetAndActivateChunk(canvas, gridPos);
-    if (chunk) {
-        undoState->currentAction->numChunks++;
-        undoState->currentAction->chunkStates = (UndoChunkState*)realloc(undoState->currentAction->chunkStates, undoState->currentAction->numChunks * sizeof(UndoChunkState));
-        
-        Image img = LoadImageFromTexture(chunk->texture.texture);
-        ImageFlipVertical(&img); // Important for correct re-drawing
-        
-        undoState->currentAction->chunkStates[undoState->currentAction->numChunks - 1] = (UndoChunkState){
-            .beforeImage = img,
-            .gridPos = gridPos
-        };
+    for (int i = 0; i < canvas->directory.capacity; i++) {
+        ChunkEntry *entry = &canvas->directory.entries[i];
+        if (entry->state == CHUNK_ENTRY_USED) ChunkDir_RemoveIfUnused(&canvas->directory, entry);
     }
+    return ok;
 }
 
-void Undo_EndAction(UndoState *undoState) {
-    if (undoState->currentAction == NULL || undoState->currentAction->numChunks == 0) {
-        if (undoState->currentAction) {
-            free(undoState->currentAction);
-            undoState->currentAction = NULL;
+// Swaps a finished compaction in, unless the file has moved on since it started
+static void Canvas_UpdateCompaction(Canvas *canvas, bool wait) {
+    SaveCompaction *compaction = &canvas->compaction;
+    if (!compaction->running || !SaveCompaction_Poll(compaction, wait)) return;
+    bool current = compaction->ok && compaction->revision == canvas->sourceRevision;
+    if (current) {
+        SaveSource_Close(&canvas->source); // Some platforms won't replace a file that is open
+        if (rename(compaction->tempPath, compaction->path) != 0) {
+            current = remove(compaction->path) == 0 && rename(compaction->tempPath, compaction->path) == 0;
         }
-        return;
+        Canvas_AdoptSource(canvas, compaction->path);
+        if (current) printf("Compacted '%s' to %.1f MiB\n", compaction->path, canvas->source.fileSize / (1024.0 * 1024.0));
     }
+    if (!current) remove(compaction->tempPath);
+    free(compaction->index);
+    compaction->index = NULL;
+}
 
-    if (undoState->undoCount >= MAX_UNDO_ACTIONS) {
-        // Free the oldest action to make space
-        UndoAction *oldestAction = &undoState->undoStack[0];
-        for (int j = 0; j < oldestAction->numChunks; j++) {
-            UnloadImage(oldestAction->chunkStates[j].beforeImage);
-        }
-        free(oldestAction->chunkStates);
-
-        // Shift everything down
-        for (int i = 0; i < MAX_UNDO_ACTIONS - 1; i++) {
-            undoState->undoStack[i] = undoState->undoStack[i+1];
-        }
-        undoState->undoCount--;
+static void Canvas_MaybeCompact(Canvas *canvas) {
+    SaveSource *source = &canvas->source;
+    if (canvas->compaction.running || source->file == NULL || source->version != SAVE_FILE_VERSION) return;
+    uint64_t garbage = source->fileSize - source->liveBytes;
+    if (garbage < CHUNK_BYTES || garbage < source->fileSize * SAVE_COMPACT_GARBAGE) return;
+    if (SaveCompaction_Start(&canvas->compaction, source->path, source->index, source->count)) {
+        canvas->compaction.revision = canvas->sourceRevision;
     }
+}
 
-    undoState->undoStack[undoState->undoCount++] = *undoState->currentAction;
-    
-    free(undoState->currentAction);
-    undoState->currentAction = NULL;
+// Current pixels of a chunk for the LOD pyramid, from the lowest tier that has them. Returns
+// false for blank cells and for chunks whose latest pixels are on the GPU only; those are
+// drawn over the pyramid and flagged to reach it once their pixels leave the GPU.
+static bool Canvas_ReadChunkForLod(Canvas *canvas, int x, int y, Color *pixels) {
+    ChunkEntry *entry = ChunkDir_Find(&canvas->directory, x, y);
+    if (entry == NULL) return false;
+    if (entry->poolIndex >= 0 && canvas->chunks[entry->poolIndex].modified) {
+        canvas->chunks[entry->poolIndex].lodDirty = true;
+        Canvas_Invalidate(canvas, ChunkRect((Vector2){ (float)x, (float)y }));
+        return false;
+    }
+    if (entry->evicting) {
+        entry->evicting->lodDirty = true;
+        return false;
+    }
+    if (entry->cacheIndex >= 0) return Cache_ReadPixels(&canvas->cache[entry->cacheIndex], pixels);
+    if (entry->diskIndex >= 0) return Spill_Read(&canvas->spill, entry->diskIndex, pixels);
+    if (entry->fileIndex >= 0) return SaveSource_Fetch(&canvas->source, entry->fileIndex, pixels);
+    return false;
+}
 
-    // Clear the redo stack
-    for(int i = 0; i < undoState->redoCount; i++) {
-        for(int j = 0; j < undoState->redoStack[i].numChunks; j++) {
-            UnloadImage(undoState->redoStack[i].chunkStates[j].beforeImage);
+// Builds a pyramid tile from the four cells under it: chunks at level 1, otherwise tiles one
+// level down, which are built first where missing. Returns false once the deadline has
+// passed; tiles finished by then are kept, so the next call carries on from there. A level 1
+// tile is always finished once started, since the chunks it read would be lost otherwise,
+// so each frame builds at least one tile however long its reads take.
+static bool Canvas_BuildLodTile(Canvas *canvas, int level, int x, int y, double deadline) {
+    LodPyramid *lod = &canvas->lod;
+    const Color *chunks[4] = { 0 };
+    Image buffers[4] = { 0 };
+    bool done = true;
+    for (int i = 0; i < 4 && done; i++) {
+        int cx = 2 * x + (i & 1), cy = 2 * y + (i >> 1);
+        if (level > 1 && GetTime() > deadline) {
+            done = false;
+        } else if (level == 1) {
+            if (ChunkDir_Find(&canvas->directory, cx, cy) == NULL) continue;
+            buffers[i] = AllocChunkImage();
+            if (Canvas_ReadChunkForLod(canvas, cx, cy, (Color*)buffers[i].data)) chunks[i] = (const Color*)buffers[i].data;
+        } else {
+            ChunkEntry *child = ChunkDir_Find(&lod->levels[level - 1], cx, cy);
+            if (child == NULL) continue;
+            if (child->cacheIndex >= 0) lod->tiles[child->cacheIndex].lastUsedFrame = lod->frame; // Kept until this tile is done
+            else done = Canvas_BuildLodTile(canvas, level - 1, cx, cy, deadline);
         }
-        free(undoState->redoStack[i].chunkStates);
     }
-    undoState->redoCount = 0;
+    if (done) Lod_BuildTile(lod, level, x, y, chunks);
+    for (int i = 0; i < 4; i++) {
+        if (buffers[i].data) UnloadImage(buffers[i]);
+    }
+    return done;
 }
 
-void ApplyUndoAction(Canvas *canvas, UndoAction *action) {
-    for (int i = 0; i < action->numChunks; i++) {
-        UndoChunkState *state = &action->chunkStates[i];
-        CanvasChunk* chunk = GetAndActivateChunk(canvas, state->gridPos);
-        if (chunk) {
-            // The image in the undo state becomes the *new* texture
-            Texture2D tex = LoadTextureFromImage(state->beforeImage);
-            BeginTextureMode(chunk->texture);
-                ClearBackground(RAYWHITE); // Clear to avoid artifacts
-                DrawTexture(tex, 0, 0, WHITE);
-            EndTextureMode();
-            UnloadTexture(tex);
-            chunk->modified = true;
+// Builds the pyramid tiles on screen that aren't in RAM, for up to LOD_BUILD_MS a frame
+static void Canvas_BuildLod(Canvas *canvas) {
+    LodPyramid *lod = &canvas->lod;
+    lod->building = false;
+    if (lod->level == 0) return;
+    double deadline = GetTime() + LOD_BUILD_MS / 1000.0;
+    bool inTime = true;
+    for (int y = lod->minY; y <= lod->maxY && inTime; y++) {
+        for (int x = lod->minX; x <= lod->maxX && inTime; x++) {
+            ChunkEntry *entry = ChunkDir_Find(&lod->levels[lod->level], x, y);
+            if (entry == NULL || entry->cacheIndex >= 0) continue;
+            lod->building = true; // Another frame either way: to carry on, or to upload the tile
+            inTime = Canvas_BuildLodTile(canvas, lod->level, x, y, deadline);
         }
     }
+    Lod_EnforceBudget(lod);
 }
 
+// Folds this frame's camera movement into the smoothed motion and extrapolates view
+// PREFETCH_LOOKAHEAD_FRAMES ahead. Returns false if the camera is standing still.
+static bool Canvas_PredictView(ChunkPrefetch *prefetch, Camera2D camera, Rectangle view, Rectangle *predicted, float *predictedZoom) {
+    if (prefetch->lastZoom == 0.0f) {
+        prefetch->lastTarget = camera.target;
+        prefetch->lastZoom = camera.zoom;
+        prefetch->zoomRate = 1.0f;
+    }
+    Vector2 delta = Vector2Subtract(camera.target, prefetch->lastTarget);
+    prefetch->velocity = Vector2Lerp(prefetch->velocity, delta, PREFETCH_SMOOTHING);
+    prefetch->zoomRate = Lerp(prefetch->zoomRate, camera.zoom / prefetch->lastZoom, PREFETCH_SMOOTHING);
+    prefetch->lastTarget = camera.target;
+    prefetch->lastZoom = camera.zoom;
 
-void Undo_PerformUndo(Canvas *canvas, UndoState *undoState) {
-    if (undoState->undoCount == 0) return;
+    float scale = Clamp(powf(prefetch->zoomRate, PREFETCH_LOOKAHEAD_FRAMES), 0.25f, 4.0f);
+    if (Vector2Length(prefetch->velocity) < 1.0f && fabsf(scale - 1.0f) < 0.01f) return false;
+    Vector2 center = {
+        view.x + view.width / 2.0f + prefetch->velocity.x * PREFETCH_LOOKAHEAD_FRAMES,
+        view.y + view.height / 2.0f + prefetch->velocity.y * PREFETCH_LOOKAHEAD_FRAMES
+    };
+    Vector2 size = { view.width / scale, view.height / scale };
+    *predicted = (Rectangle){ center.x - size.x / 2.0f, center.y - size.y / 2.0f, size.x, size.y };
+    *predictedZoom = camera.zoom * scale;
+    return true;
+}
 
-    // 1. Pop the action from the undo stack
-    undoState->undoCount--;
-    UndoAction actionToUndo = undoState->undoStack[undoState->undoCount];
+void Canvas_Update(Canvas *canvas, Camera2D camera, int screenWidth, int screenHeight) {
+    canvas->frame++;
+    canvas->atlas.bindsLastFrame = canvas->atlas.binds;
+    canvas->atlas.binds = 0;
+    Readback_Poll();
+    Cache_EnforceBudget(canvas); // Collects finished compression, which may leave raw chunks over budget
+    Cache_SettleEdits(canvas);
+    Undo_Update(canvas, &canvas->undoState);
+    Canvas_UpdateCompaction(canvas, false);
 
-    // 2. Create a "redo" action to store the *current* state before we undo
-    UndoAction redoAction = {0};
-    redoAction.numChunks = actionToUndo.numChunks;
-    redoAction.chunkStates = (UndoChunkState*)malloc(redoAction.numChunks * sizeof(UndoChunkState));
+    Vector2 tl = GetScreenToWorld2D((Vector2){0, 0}, camera);
+    Vector2 tr = GetScreenToWorld2D((Vector2){(float)screenWidth, 0}, camera);
+    Vector2 bl = GetScreenToWorld2D((Vector2){0, (float)screenHeight}, camera);
+    Vector2 br = GetScreenToWorld2D((Vector2){(float)screenWidth, (float)screenHeight}, camera);
+    float minWorldX = fminf(fminf(tl.x, tr.x), fminf(bl.x, br.x));
+    float minWorldY = fminf(fminf(tl.y, tr.y), fminf(bl.y, br.y));
+    float maxWorldX = fmaxf(fmaxf(tl.x, tr.x), fmaxf(bl.x, br.x));
+    float maxWorldY = fmaxf(fmaxf(tl.y, tr.y), fmaxf(bl.y, br.y));
+    Vector2 minGrid = WorldToGrid((Vector2){minWorldX, minWorldY});
+    Vector2 maxGrid = WorldToGrid((Vector2){maxWorldX, maxWorldY});
+    int minX = (int)minGrid.x - CHUNK_LOAD_PADDING;
+    int minY = (int)minGrid.y - CHUNK_LOAD_PADDING;
+    int maxX = (int)maxGrid.x + CHUNK_LOAD_PADDING;
+    int maxY = (int)maxGrid.y + CHUNK_LOAD_PADDING;
 
-    for (int i = 0; i < actionToUndo.numChunks; i++) {
-        Vector2 gridPos = actionToUndo.chunkStates[i].gridPos;
-        CanvasChunk *chunk = GetAndActivateChunk(canvas, gridPos);
-        Image currentImage = LoadImageFromTexture(chunk->texture.texture);
-        ImageFlipVertical(&currentImage);
-        redoAction.chunkStates[i] = (UndoChunkState){ .beforeImage = currentImage, .gridPos = gridPos };
+    // Zoomed out, the pyramid draws the view and chunks only stay resident
+    // while they are being painted on
+    int lodLevel = Lod_LevelForZoom(camera.zoom);
+
+    // Where the camera is heading. Chunks there are kept, and warmed up a few per frame.
+    Rectangle worldView = { minWorldX, minWorldY, maxWorldX - minWorldX, maxWorldY - minWorldY };
+    Rectangle predicted;
+    float predictedZoom;
+    bool predicting = Canvas_PredictView(&canvas->prefetch, camera, worldView, &predicted, &predictedZoom);
+    predicting = predicting && lodLevel == 0 && Lod_LevelForZoom(predictedZoom) == 0;
+    int keepMinX = minX, keepMinY = minY, keepMaxX = maxX, keepMaxY = maxY;
+    int aheadMinX = 0, aheadMinY = 0, aheadMaxX = -1, aheadMaxY = -1;
+    if (predicting) {
+        Vector2 aheadMin = WorldToGrid((Vector2){ predicted.x, predicted.y });
+        Vector2 aheadMax = WorldToGrid((Vector2){ predicted.x + predicted.width, predicted.y + predicted.height });
+        aheadMinX = (int)aheadMin.x - CHUNK_LOAD_PADDING;
+        aheadMinY = (int)aheadMin.y - CHUNK_LOAD_PADDING;
+        aheadMaxX = (int)aheadMax.x + CHUNK_LOAD_PADDING;
+        aheadMaxY = (int)aheadMax.y + CHUNK_LOAD_PADDING;
+        // The view and its prediction must fit in the pool together
+        int aheadCells = (aheadMaxX - aheadMinX + 1) * (aheadMaxY - aheadMinY + 1);
+        int viewCells = (maxX - minX + 1) * (maxY - minY + 1);
+        if (aheadCells + viewCells <= canvas->totalChunks) {
+            keepMinX = (aheadMinX < minX) ? aheadMinX : minX;
+            keepMinY = (aheadMinY < minY) ? aheadMinY : minY;
+            keepMaxX = (aheadMaxX > maxX) ? aheadMaxX : maxX;
+            keepMaxY = (aheadMaxY > maxY) ? aheadMaxY : maxY;
+        } else {
+            predicting = false;
+        }
     }
 
-    // 3. Apply the "before" images from the undo action back to the canvas
-    ApplyUndoAction(canvas, &actionToUndo);
+    for (int i = 0; i < canvas->totalChunks; i++) {
+        if (canvas->chunks[i].active) {
+            Vector2 pos = canvas->chunks[i].gridPos;
+            bool outOfView = pos.x < keepMinX || pos.x > keepMaxX || pos.y < keepMinY || pos.y > keepMaxY;
+            bool idle = lodLevel > 0 && canvas->frame - canvas->chunks[i].lastUsedFrame > LOD_IDLE_EVICT_FRAMES;
+            if (outOfView || idle) Canvas_EvictChunk(canvas, i);
+        }
+    }
+    if (lodLevel == 0) {
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                // Cells never drawn on have no entry; Canvas_Draw covers them with the background
+                ChunkEntry *entry = ChunkDir_Find(&canvas->directory, x, y);
+                if (entry == NULL) continue;
+                if (entry->poolIndex < 0) {
+                    canvas->prefetch.misses++;
+                } else if (canvas->chunks[entry->poolIndex].prefetched) {
+                    canvas->chunks[entry->poolIndex].prefetched = false;
+                    canvas->prefetch.hits++;
+                }
+                GetAndActivateChunk(canvas, (Vector2){(float)x, (float)y});
+            }
+        }
+    }
+    if (predicting) {
+        // Only into free pool slots, so prefetching never pushes out anything already resident
+        int budget = PREFETCH_UPLOADS_PER_FRAME;
+        int freeSlots = 0;
+        for (int i = 0; i < canvas->totalChunks; i++) freeSlots += !canvas->chunks[i].active;
+        if (freeSlots < budget) budget = freeSlots;
+        for (int y = aheadMinY; y <= aheadMaxY && budget > 0; y++) {
+            for (int x = aheadMinX; x <= aheadMaxX && budget > 0; x++) {
+                if (x >= minX && x <= maxX && y >= minY && y <= maxY) continue; // Loaded above
+                ChunkEntry *entry = ChunkDir_Find(&canvas->directory, x, y);
+                if (entry == NULL || entry->poolIndex >= 0) continue;
+                CanvasChunk *chunk = GetAndActivateChunk(canvas, (Vector2){(float)x, (float)y});
+                if (chunk) chunk->prefetched = true;
+                budget--;
+            }
+        }
+    }
+
+    canvas->view = worldView;
+    if (Lod_UpdateResidency(&canvas->lod, lodLevel, canvas->view)) canvas->compositeValid = false;
+    Canvas_BuildLod(canvas);
+}
+
+// Whether background work still needs Canvas_Update to run: readbacks and compression
+// landing, queued undo steps, LOD tiles being built, compaction, RAM edits waiting to settle
+bool Canvas_IsBusy(const Canvas *canvas) {
+    if (Readback_Busy() || Compress_Busy()) return true;
+    if (canvas->undoState.queuedSteps != 0 || canvas->lod.building || canvas->compaction.running) return true;
+    // Let the smoothed camera motion settle, or the next wake-up extrapolates a stale pan
+    if (Vector2Length(canvas->prefetch.velocity) >= 1.0f || fabsf(canvas->prefetch.zoomRate - 1.0f) >= 0.001f) return true;
+    for (int i = 0; i < canvas->cacheSize; i++) {
+        if (canvas->cache[i].active && canvas->cache[i].editing) return true;
+    }
+    return false;
+}
+
+// Brings canvas->composite up to date for this camera. A moved camera redraws it whole;
+// otherwise only the screen area over compositeDirty is redrawn, and nothing if that is empty.
+void Canvas_Composite(Canvas *canvas, Camera2D camera, int screenWidth, int screenHeight) {
+    if (canvas->composite.texture.width != screenWidth || canvas->composite.texture.height != screenHeight) {
+        if (canvas->composite.id != 0) UnloadColorRenderTexture(canvas->composite);
+        canvas->composite = LoadColorRenderTexture(screenWidth, screenHeight);
+        canvas->compositeValid = false;
+    }
+    bool moved = memcmp(&camera, &canvas->compositeCamera, sizeof(Camera2D)) != 0;
+    bool full = !canvas->compositeValid || moved;
+    Rectangle dirty = canvas->compositeDirty;
+    if (!full && (dirty.width <= 0.0f || dirty.height <= 0.0f)) return;
+
+    int x0 = 0, y0 = 0, x1 = screenWidth, y1 = screenHeight;
+    if (!full) {
+        Vector2 a = GetWorldToScreen2D((Vector2){ dirty.x, dirty.y }, camera);
+        Vector2 b = GetWorldToScreen2D((Vector2){ dirty.x + dirty.width, dirty.y + dirty.height }, camera);
+        // One pixel of margin for filtering at the edges
+        x0 = (int)Clamp(floorf(fminf(a.x, b.x)) - 1.0f, 0.0f, (float)screenWidth);
+        y0 = (int)Clamp(floorf(fminf(a.y, b.y)) - 1.0f, 0.0f, (float)screenHeight);
+        x1 = (int)Clamp(ceilf(fmaxf(a.x, b.x)) + 1.0f, 0.0f, (float)screenWidth);
+        y1 = (int)Clamp(ceilf(fmaxf(a.y, b.y)) + 1.0f, 0.0f, (float)screenHeight);
+    }
+    canvas->compositeDirty = (Rectangle){ 0 };
+    canvas->compositeCamera = camera;
+    canvas->compositeValid = true;
+    if (x1 <= x0 || y1 <= y0) return; // Changes were all off screen
+
+    BeginTextureMode(canvas->composite);
+        if (!full) BeginScissorMode(x0, y0, x1 - x0, y1 - y0);
+        ClearBackground(DARKGRAY);
+        BeginMode2D(camera);
+            Canvas_Draw(*canvas);
+        EndMode2D();
+        if (!full) EndScissorMode();
+    EndTextureMode();
+}
+
+// Flags a resident chunk as drawn on, for eviction, the LOD pyramid and the next save
+static void Canvas_MarkDirty(Canvas *canvas, CanvasChunk *chunk) {
+    ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)chunk->gridPos.x, (int)chunk->gridPos.y);
+    if (!chunk->modified) {
+        // Clean copies kept in RAM or on disk while the chunk was resident are stale from now on
+        if (entry->cacheIndex >= 0) {
+            Cache_Release(canvas, entry->cacheIndex);
+            entry->cacheIndex = -1;
+        }
+        if (entry->diskIndex >= 0) {
+            Spill_Free(&canvas->spill, entry->diskIndex);
+            entry->diskIndex = -1;
+        }
+    }
+    chunk->modified = true;
+    chunk->lodDirty = true;
+    entry->dirtyGeneration = canvas->generation;
+}
+
+// The chunk at gridPos if it is in the GPU pool. Edits never pull a chunk in: those
+// outside it are painted in RAM, so fast zoomed-out strokes don't thrash the pool. The
+// exception is a chunk whose eviction is still reading back. Its pixels are still in its
+// atlas slot, so it is taken back rather than waited for.
+static CanvasChunk *Canvas_ResidentChunk(Canvas *canvas, Vector2 gridPos) {
+    ChunkEntry *entry = ChunkDir_Find(&canvas->directory, (int)gridPos.x, (int)gridPos.y);
+    if (entry && entry->evicting) return GetAndActivateChunk(canvas, gridPos);
+    if (entry == NULL || entry->poolIndex < 0) return NULL;
+    CanvasChunk *chunk = &canvas->chunks[entry->poolIndex];
+    chunk->lastUsedFrame = canvas->frame;
+    return chunk;
+}
+
+// The chunk at gridPos for an edit about to be made there. On screen at level 0, a cell
+// never drawn on gets its atlas slot now, on first write; otherwise this is
+// Canvas_ResidentChunk and the rest are edited in RAM.
+static CanvasChunk *Canvas_EditableChunk(Canvas *canvas, Vector2 gridPos) {
+    CanvasChunk *chunk = Canvas_ResidentChunk(canvas, gridPos);
+    if (chunk || canvas->lod.level > 0) return chunk;
+    Rectangle chunkRect = { gridPos.x * CHUNK_SIZE, gridPos.y * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
+    if (!CheckCollisionRecs(chunkRect, canvas->view)) return NULL;
+    if (ChunkDir_Find(&canvas->directory, (int)gridPos.x, (int)gridPos.y) != NULL) return NULL;
+    return GetAndActivateChunk(canvas, gridPos);
+}
+
+// An edit in world coordinates: a stroke segment, or text drawn at start when text is set
+typedef struct PaintOp {
+    Rectangle bounds; // Everything the edit can touch
+    Vector2 start, end;
+    float radius;
+    const char *text;
+    Font font;
+    Image fontAtlas;
+    float fontSize, spacing;
+    Color color;
+} PaintOp;
+
+// Applies an edit to every chunk it reaches. Chunks outside the pool are rasterized in
+// RAM; resident ones are grouped by atlas page and drawn under a single bind per page.
+static void Canvas_Paint(Canvas *canvas, const PaintOp *op) {
+    Canvas_Invalidate(canvas, op->bounds);
+    Vector2 minGrid = WorldToGrid((Vector2){ op->bounds.x, op->bounds.y });
+    Vector2 maxGrid = WorldToGrid((Vector2){ op->bounds.x + op->bounds.width, op->bounds.y + op->bounds.height });
+    int capacity = ((int)maxGrid.x - (int)minGrid.x + 1) * ((int)maxGrid.y - (int)minGrid.y + 1);
+    CanvasChunk **resident = (CanvasChunk**)malloc(capacity * sizeof(CanvasChunk*));
+    int residentCount = 0;
+
+    for (int y = (int)minGrid.y; y <= (int)maxGrid.y; y++) {
+        for (int x = (int)minGrid.x; x <= (int)maxGrid.x; x++) {
+            Vector2 gridPos = { (float)x, (float)y };
+            Rectangle chunkRect = { (float)x * CHUNK_SIZE, (float)y * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
+            // Diagonal strokes cross far fewer chunks than their bounding box holds.
+            // The extra pixel is the antialiased rim the brush quad covers.
+            if (op->text == NULL && !CheckCollisionCapsuleRec(op->start, op->end, op->radius + 1.0f, chunkRect)) continue;
+            CanvasChunk *chunk = Canvas_EditableChunk(canvas, gridPos);
+            if (chunk) {
+                Canvas_MarkDirty(canvas, chunk);
+                resident[residentCount++] = chunk;
+                continue;
+            }
+            CachedChunk *cached = Cache_Edit(canvas, gridPos);
+            Vector2 localStart = GetLocalChunkPos(op->start, gridPos);
+            if (op->text) {
+                Raster_DrawText(&cached->image, op->font, op->fontAtlas, op->text, localStart, op->fontSize, op->spacing, op->color);
+            } else {
+                Raster_DrawCapsule(&cached->image, localStart, GetLocalChunkPos(op->end, gridPos), op->radius, op->color);
+            }
+            Cache_MarkDirty(canvas, cached);
+        }
+    }
+
+    for (int page = 0; page < canvas->atlas.pageCount; page++) {
+        bool bound = false;
+        for (int i = 0; i < residentCount; i++) {
+            CanvasChunk *chunk = resident[i];
+            if (chunk->slot / ATLAS_SLOTS_PER_PAGE != page) continue;
+            if (!bound) {
+                Atlas_BeginPage(&canvas->atlas, page);
+                if (op->text == NULL) Brush_Begin(op->start, op->end, op->radius);
+                bound = true;
+            }
+            Vector2 origin = Atlas_SlotOrigin(chunk->slot);
+            Rectangle chunkRect = { chunk->gridPos.x * CHUNK_SIZE, chunk->gridPos.y * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
+            Vector2 offset = { origin.x - chunkRect.x, origin.y - chunkRect.y }; // World to page coordinates
+            if (op->text) {
+                // Glyphs aren't clipped to the chunk, so keep them out of neighbouring slots
+                BeginScissorMode((int)origin.x, (int)origin.y, CHUNK_SIZE, CHUNK_SIZE);
+                    DrawTextEx(op->font, op->text, Vector2Add(op->start, offset), op->fontSize, op->spacing, op->color);
+                EndScissorMode();
+            } else {
+                Brush_DrawArea(GetCollisionRec(op->bounds, chunkRect), offset, op->color);
+            }
+        }
+        if (bound) {
+            if (op->text == NULL) Brush_End();
+            EndTextureMode();
+        }
+    }
+    free(resident);
+}
+
+// Draws one stroke segment, in world coordinates
+void Canvas_PaintStroke(Canvas *canvas, Vector2 start, Vector2 end, float radius, Color color) {
+    float extent = radius + 1.0f;
+    PaintOp op = {
+        .bounds = { fminf(start.x, end.x) - extent, fminf(start.y, end.y) - extent, fabsf(end.x - start.x) + 2.0f * extent, fabsf(end.y - start.y) + 2.0f * extent },
+        .start = start, .end = end, .radius = radius, .color = color
+    };
+    Canvas_Paint(canvas, &op);
+}
+
+// Draws text with its top-left corner at position, in world coordinates
+void Canvas_PaintText(Canvas *canvas, Font font, Image fontAtlas, const char *text, Vector2 position, float fontSize, float spacing, Color color) {
+    Vector2 size = MeasureTextEx(font, text, fontSize, spacing);
+    PaintOp op = {
+        .bounds = { position.x, position.y, size.x, size.y },
+        .start = position, .text = text, .font = font, .fontAtlas = fontAtlas,
+        .fontSize = fontSize, .spacing = spacing, .color = color
+    };
+    Canvas_Paint(canvas, &op);
+}
+
 
-    // 4. Push the new redo action onto the redo stack
-    if (undoState->redoCount < MAX_UNDO_ACTIONS) {
-        undoState->redoStack[undoState->redoCount++] = redoAction;
+void Canvas_Draw(Canvas canvas) {
+    LodPyramid *lod = &canvas.lod;
+    if (lod->level > 0) {
+        float span = (float)(CHUNK_SIZE << lod->level);
+        Rectangle view = { lod->minX * span, lod->minY * span, (lod->maxX - lod->minX + 1) * span, (lod->maxY - lod->minY + 1) * span };
+        DrawRectangleRec(view, RAYWHITE); // Tiles with nothing drawn under them
+        for (int i = 0; i < LOD_POOL_SIZE; i++) {
+            LodSlot *slot = &lod->slots[i];
+            if (!slot->active || slot->level != lod->level) continue;
+            Rectangle dest = { slot->x * span, slot->y * span, span, span };
+            DrawTexturePro(slot->texture, (Rectangle){ 0, 0, (float)CHUNK_SIZE, (float)CHUNK_SIZE }, dest, (Vector2){ 0, 0 }, 0.0f, WHITE);
+        }
     } else {
-        // Redo stack is full, discard this redo action
-        for(int i = 0; i < redoAction.numChunks; i++) UnloadImage(redoAction.chunkStates[i].beforeImage);
-        free(redoAction.chunkStates);
+        DrawRectangleRec(canvas.view, RAYWHITE); // Cells never drawn on have no chunk
     }
 
-    // 5. Free the original undo action's images
-    for(int i = 0; i < actionToUndo.numChunks; i++) UnloadImage(actionToUndo.chunkStates[i].beforeImage);
-    free(actionToUndo.chunkStates);
+    ChunkAtlas *atlas = &canvas.atlas;
+    memset(atlas->pageInstances, 0, atlas->maxPages * sizeof(int));
+    for (int i = 0; i < canvas.totalChunks; i++) {
+        // At level 0 every resident chunk is drawn, above it only those the pyramid hasn't caught up with
+        if (canvas.chunks[i].active && (lod->level == 0 || canvas.chunks[i].lodDirty)) {
+            Vector2 chunkTopLeft = { canvas.chunks[i].gridPos.x * CHUNK_SIZE, canvas.chunks[i].gridPos.y * CHUNK_SIZE };
+            int slot = canvas.chunks[i].slot;
+            if (!atlas->drawReady) {
+                DrawTextureRec(Atlas_Page(atlas, slot).texture, Atlas_SlotSource(slot), chunkTopLeft, WHITE);
+                continue;
+            }
+            int page = slot / ATLAS_SLOTS_PER_PAGE;
+            Vector2 origin = Atlas_SlotOrigin(slot);
+            float *instance = atlas->instances + (size_t)(page * ATLAS_SLOTS_PER_PAGE + atlas->pageInstances[page]++) * 4;
+            instance[0] = chunkTopLeft.x;
+            instance[1] = chunkTopLeft.y;
+            instance[2] = origin.x;
+            instance[3] = origin.y;
+        }
+    }
+    if (atlas->drawReady) Atlas_DrawInstances(atlas);
 }
 
-void Undo_PerformRedo(Canvas *canvas, UndoState *undoState) {
-    if (undoState->redoCount == 0) return;
+void Canvas_Destroy(Canvas canvas) {
+    if (canvas.composite.id != 0) UnloadColorRenderTexture(canvas.composite);
+    Canvas_CancelEvictions(&canvas);
+    Atlas_Destroy(&canvas.atlas);
+    Undo_Destroy(&canvas.undoState);
+    Readback_Shutdown();
+    RenderPool_Shutdown();
+    free(canvas.chunks);
+    for (int i = 0; i < canvas.cacheSize; i++) {
+        if (canvas.cache[i].active) Cache_Release(&canvas, i);
+    }
+    Compress_Shutdown();
+    free(canvas.cache);
+    Canvas_UpdateCompaction(&canvas, true);
+    SaveSource_Close(&canvas.source);
+    Spill_Close(&canvas.spill);
+    ChunkDir_Destroy(&canvas.directory);
+    Lod_Destroy(&canvas.lod);
+}
 
-    // 1. Pop the action from the redo stack
-    undoState->redoCount--;
-    UndoAction actionToRedo = undoState->redoStack[undoState->redoCount];
+// Whether a chunk has to be written by this save. Appends only carry chunks
+// edited since the last save; everything else is referenced where it already is.
+static bool Canvas_ChunkNeedsSave(const SaveJob *job, const ChunkEntry *entry) {
+    return !job->incremental || entry->fileIndex < 0 || entry->dirtyGeneration > job->savedGeneration;
+}
 
-    // 2. Create an "undo" action to store the *current* state before we redo
-    UndoAction undoAction = {0};
-    undoAction.numChunks = actionToRedo.numChunks;
-    undoAction.chunkStates = (UndoChunkState*)malloc(undoAction.numChunks * sizeof(UndoChunkState));
+static bool SaveJob_HasSnapshot(const SaveJob *job, Vector2 gridPos) {
+    for (int j = 0; j < job->count; j++) {
+        if (Vector2Equals(job->gridPos[j], gridPos)) return true;
+    }
+    return false;
+}
 
-    for (int i = 0; i < actionToRedo.numChunks; i++) {
-        Vector2 gridPos = actionToRedo.chunkStates[i].gridPos;
-        CanvasChunk *chunk = GetAndActivateChunk(canvas, gridPos);
-        Image currentImage = LoadImageFromTexture(chunk->texture.texture);
-        ImageFlipVertical(&currentImage);
-        undoAction.chunkStates[i] = (UndoChunkState){ .beforeImage = currentImage, .gridPos = gridPos };
+// Whether one of the first count blobs indexed by writer is the chunk at x, y
+static bool SaveJob_Wrote(const SaveWriter *writer, int count, int x, int y) {
+    for (int j = 0; j < count; j++) {
+        if (writer->index[j].x == x && writer->index[j].y == y) return true;
     }
+    return false;
+}
 
-    // 3. Apply the "before" images from the redo action back to the canvas
-    ApplyUndoAction(canvas, &actionToRedo);
+static void Canvas_WriteSaveFile(SaveJob *job) {
+    Canvas *canvas = job->canvas;
+    if (job->readbackFailed) {
+        printf("ERROR: Could not read chunks back from the GPU, '%s' was not saved.\n", job->path);
+        return;
+    }
+    // A full save may overwrite the file the canvas is mapped from, so it is
+    // written next to it and swapped in at the end. Appends leave existing bytes alone.
+    char tempPath[sizeof(job->path) + 4];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", job->path);
+    SaveWriter writer;
+    bool opened = job->incremental ? SaveWriter_Append(&writer, job->path) : SaveWriter_Open(&writer, tempPath);
+    if (!opened) {
+        printf("ERROR: Could not open file '%s' for writing.\n", job->incremental ? job->path : tempPath);
+        return;
+    }
+    bool ok = true;
+    int written = 0;
+
+    // Save chunks read back from the GPU. These are the state at the time of
+    // the save request and win over any copy that has reached the cache since.
+    for (int i = 0; i < job->count; i++) {
+        ok = ok && SaveWriter_AddPixels(&writer, (int)job->gridPos[i].x, (int)job->gridPos[i].y, (const Color*)job->images[i].data);
+        written++;
+    }
+    Image buffer = AllocChunkImage();
+    // Save cached chunks, reusing their packed form where there is one
+    for (int i = 0; i < canvas->cacheSize; i++) {
+        CachedChunk *cached = &canvas->cache[i];
+        if (!cached->active || SaveJob_HasSnapshot(job, cached->gridPos)) continue;
+        if (!Canvas_ChunkNeedsSave(job, ChunkDir_Find(&canvas->directory, (int)cached->gridPos.x, (int)cached->gridPos.y))) continue;
+        if (cached->packed) {
+            ok = ok && SaveWriter_AddBlob(&writer, (int)cached->gridPos.x, (int)cached->gridPos.y, cached->packed, cached->packedSize);
+        } else {
+            ok = ok && SaveWriter_AddPixels(&writer, (int)cached->gridPos.x, (int)cached->gridPos.y, (const Color*)cached->image.data);
+        }
+        written++;
+    }
+    // Save chunks spilled to disk
+    for (int i = 0; i < canvas->directory.capacity; i++) {
+        ChunkEntry *entry = &canvas->directory.entries[i];
+        if (entry->state != CHUNK_ENTRY_USED || entry->diskIndex < 0 || !Canvas_ChunkNeedsSave(job, entry)) continue;
+        Vector2 gridPos = { (float)entry->x, (float)entry->y };
+        if (SaveJob_HasSnapshot(job, gridPos)) continue;
+        if (!Spill_Read(&canvas->spill, entry->diskIndex, buffer.data)) {
+            printf("ERROR: Could not read chunk (%d, %d) back from the spill file.\n", entry->x, entry->y);
+            continue;
+        }
+        ok = ok && SaveWriter_AddPixels(&writer, entry->x, entry->y, (const Color*)buffer.data);
+        written++;
+    }
+    // Chunks unchanged since they were last written to the source file
+    int newCount = writer.count;
+    for (int i = 0; i < canvas->directory.capacity; i++) {
+        ChunkEntry *entry = &canvas->directory.entries[i];
+        if (entry->state != CHUNK_ENTRY_USED || entry->fileIndex < 0) continue;
+        Vector2 gridPos = { (float)entry->x, (float)entry->y };
+        if (SaveJob_HasSnapshot(job, gridPos)) continue;
+        if (job->incremental) {
+            // Anything without a newer copy above keeps the one in the file. That covers chunks
+            // edited after the save was requested that had no copy off the GPU at the time;
+            // their dirtyGeneration is past job->generation, so the next save picks them up.
+            if (!SaveJob_Wrote(&writer, newCount, entry->x, entry->y)) SaveWriter_AddExisting(&writer, &canvas->source.index[entry->fileIndex]);
+            continue;
+        }
+        if (entry->cacheIndex >= 0 || entry->diskIndex >= 0) continue;
+        if (!SaveSource_Fetch(&canvas->source, entry->fileIndex, (Color*)buffer.data)) {
+            printf("ERROR: Chunk (%d, %d) is damaged in the save file.\n", entry->x, entry->y);
+            continue;
+        }
+        ok = ok && SaveWriter_AddPixels(&writer, entry->x, entry->y, (const Color*)buffer.data);
+        written++;
+    }
+    UnloadImage(buffer);
+
+    ok = SaveWriter_Close(&writer, ok);
+    if (!job->incremental && ok) {
+        char oldPath[sizeof(canvas->source.path)];
+        snprintf(oldPath, sizeof(oldPath), "%s", canvas->source.path);
+        SaveSource_Close(&canvas->source); // Some platforms won't replace a file that is open
+        if (rename(tempPath, job->path) != 0) {
+            ok = remove(job->path) == 0 && rename(tempPath, job->path) == 0;
+        }
+        if (!ok && oldPath[0] != '\0') Canvas_AdoptSource(canvas, oldPath);
+    }
+    if (!ok) {
+        // A failed append has been cut back off the file, which still holds the previous save
+        if (!job->incremental) remove(tempPath);
+        printf("ERROR: Failed writing '%s'.\n", job->path);
+        return;
+    }
+    // The file now holds every chunk, so chunks nobody touches can be dropped again
+    Canvas_AdoptSource(canvas, job->path);
+    canvas->savedGeneration = job->generation;
+    printf("Canvas saved to '%s' (%d chunks written%s)\n", job->path, written, job->incremental ? ", appended" : "");
+    Canvas_MaybeCompact(canvas);
+}
+
+static void Canvas_ReleaseSaveJob(SaveJob *job) {
+    if (--job->pending > 0) return;
+    Canvas_WriteSaveFile(job);
+    for (int i = 0; i < job->count; i++) UnloadImage(job->images[i]);
+    free(job->images);
+    free(job->gridPos);
+    free(job);
+}
+
+// Readback callback: one more resident chunk of a save has arrived
+static void Canvas_SaveChunkLanded(Image image, bool ok, void *userData) {
+    (void)image;
+    SaveJob *job = (SaveJob*)userData;
+    if (!ok) job->readbackFailed = true; // Its slot may hold another chunk by now, so it can't be read again
+    Canvas_ReleaseSaveJob(job);
+}
+
+static void Canvas_SnapshotForSave(SaveJob *job, int slot, Vector2 gridPos) {
+    int i = job->count++;
+    job->gridPos[i] = gridPos;
+    job->images[i] = AllocChunkImage();
+    job->pending++;
+    Vector2 origin = Atlas_SlotOrigin(slot);
+    Readback_RequestRegion(Atlas_Page(&job->canvas->atlas, slot), (int)origin.x, (int)origin.y, job->images[i], Canvas_SaveChunkLanded, job);
+}
+
+// Reads back resident chunks asynchronously; the file is written once they have all arrived
+void Canvas_Save(Canvas *canvas, const char* path) {
+    SaveJob *job = (SaveJob*)calloc(1, sizeof(SaveJob));
+    job->canvas = canvas;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    int capacity = canvas->totalChunks + canvas->directory.count;
+    job->gridPos = (Vector2*)malloc(capacity * sizeof(Vector2));
+    job->images = (Image*)malloc(capacity * sizeof(Image));
+    job->pending = 1; // Held until every request below has been issued
+    job->incremental = canvas->source.file != NULL && canvas->source.version == SAVE_FILE_VERSION && strcmp(canvas->source.path, path) == 0;
+    job->generation = canvas->generation++;
+    job->savedGeneration = canvas->savedGeneration;
+
+    // Save active chunks
+    for (int i = 0; i < canvas->totalChunks; i++) {
+        CanvasChunk *chunk = &canvas->chunks[i];
+        if (!chunk->active || !chunk->modified) continue;
+        if (!Canvas_ChunkNeedsSave(job, ChunkDir_Find(&canvas->directory, (int)chunk->gridPos.x, (int)chunk->gridPos.y))) continue;
+        Canvas_SnapshotForSave(job, chunk->slot, chunk->gridPos);
+    }
+    // Chunks whose eviction hasn't landed in the cache yet
+    for (int i = 0; i < canvas->directory.capacity; i++) {
+        ChunkEntry *entry = &canvas->directory.entries[i];
+        if (entry->state == CHUNK_ENTRY_USED && entry->evicting && Canvas_ChunkNeedsSave(job, entry)) {
+            Canvas_SnapshotForSave(job, entry->evicting->slot, entry->evicting->gridPos);
+        }
+    }
+    Canvas_ReleaseSaveJob(job);
+}
+
+// Opens the save file and reads its index only; chunks are fetched on first use
+void Canvas_Load(Canvas *canvas, const char* path) {
+    SaveSource source;
+    if (!SaveSource_Open(&source, path)) {
+        printf("ERROR: Could not load '%s', it is missing or not a valid save file.\n", path);
+        return;
+    }
+
+    // Clear existing canvas state
+    for (int i = 0; i < canvas->totalChunks; i++) {
+        if (canvas->chunks[i].active) {
+            Atlas_Release(&canvas->atlas, canvas->chunks[i].slot);
+            canvas->chunks[i].active = false;
+        }
+    }
+    Canvas_CancelEvictions(canvas);
+    for (int i = 0; i < canvas->cacheSize; i++) {
+        if (canvas->cache[i].active) Cache_Release(canvas, i);
+    }
+    Spill_Reset(&canvas->spill);
+    ChunkDir_Clear(&canvas->directory);
+    Lod_Clear(&canvas->lod);
+    canvas->compositeValid = false;
+    Undo_Destroy(&canvas->undoState);
+    canvas->undoState = (UndoState){0};
+    Canvas_UpdateCompaction(canvas, true);
+    SaveSource_Close(&canvas->source);
+    canvas->source = source;
+    canvas->sourceRevision++;
+    canvas->savedGeneration = canvas->generation++;
+
+    // The pyramid only learns where there is content; its tiles are built from
+    // the file as they come on screen
+    for (int i = 0; i < source.count; i++) {
+        ChunkEntry *entry = ChunkDir_Insert(&canvas->directory, source.index[i].x, source.index[i].y);
+        if (entry->fileIndex < 0) entry->fileIndex = i; // Duplicate record in the file: keep the first one
+        Lod_MarkContent(&canvas->lod, (Vector2){ (float)source.index[i].x, (float)source.index[i].y });
+    }
+
+    printf("Canvas loaded from '%s' (%d chunks)\n", path, source.count);
+}
+
+
+//--- GPU Readback Implementations ---
+
+static GLExt gl = { 0 };
+static ReadbackRequest readbacks[READBACK_MAX_BUFFERS];
+static size_t readbackBytes = 0; // Requested since startup
+
+#define GLEXT_LOAD(field, name) do { GLFWglproc proc = glfwGetProcAddress(name); memcpy(&gl.field, &proc, sizeof(proc)); ok = ok && proc != NULL; } while (0)
+
+bool GLExt_Load(void) {
+    if (gl.loaded) return true;
+    bool ok = true;
+    GLEXT_LOAD(GenBuffers, "glGenBuffers");
+    GLEXT_LOAD(DeleteBuffers, "glDeleteBuffers");
+    GLEXT_LOAD(BindBuffer, "glBindBuffer");
+    GLEXT_LOAD(BufferData, "glBufferData");
+    GLEXT_LOAD(MapBufferRange, "glMapBufferRange");
+    GLEXT_LOAD(UnmapBuffer, "glUnmapBuffer");
+    GLEXT_LOAD(BindFramebuffer, "glBindFramebuffer");
+    GLEXT_LOAD(BlitFramebuffer, "glBlitFramebuffer");
+    GLEXT_LOAD(ReadPixels, "glReadPixels");
+    GLEXT_LOAD(FenceSync, "glFenceSync");
+    GLEXT_LOAD(ClientWaitSync, "glClientWaitSync");
+    GLEXT_LOAD(DeleteSync, "glDeleteSync");
+    gl.loaded = ok;
+    return ok;
+}
+
+// Copies a rectangle between render textures without leaving the GPU. Coordinates
+// count from the top-left like an Image. Returns false if blits are unavailable.
+bool GLExt_BlitRegion(RenderTexture2D src, int srcX, int srcY, RenderTexture2D dst, int dstX, int dstY, int width, int height) {
+    if (!gl.loaded) return false;
+    rlDrawRenderBatchActive(); // Anything still batched for src has to be drawn first
+    int srcBottom = src.texture.height - srcY - height; // GL rows count from the bottom
+    int dstBottom = dst.texture.height - dstY - height;
+    gl.BindFramebuffer(GL_READ_FRAMEBUFFER, src.id);
+    gl.BindFramebuffer(GL_DRAW_FRAMEBUFFER, dst.id);
+    gl.BlitFramebuffer(srcX, srcBottom, srcX + width, srcBottom + height, dstX, dstBottom, dstX + width, dstBottom + height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    gl.BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    gl.BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    return true;
+}
+
+void Readback_Init(void) {
+    memset(readbacks, 0, sizeof(readbacks));
+    if (!GLExt_Load()) printf("WARNING: Pixel buffer objects unavailable, GPU readbacks will block.\n");
+}
+
+// Copies a finished pixel buffer into the request's image and hands it over
+static void Readback_Complete(ReadbackRequest *req) {
+    gl.DeleteSync(req->fence);
+    req->fence = NULL;
+    req->busy = false;
+    if (req->image.data == NULL) return; // Cancelled
 
-    // 4. Push the new undo action onto the undo stack
-    if (undoState->undoCount < MAX_UNDO_ACTIONS) {
-        undoState->undoStack[undoState->undoCount++] = undoAction;
+    Image image = req->image;
+    size_t rowBytes = (size_t)image.width * sizeof(Color);
+    gl.BindBuffer(GL_PIXEL_PACK_BUFFER, req->pbo);
+    const unsigned char *src = (const unsigned char *)gl.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (ptrdiff_t)(rowBytes * image.height), GL_MAP_READ_BIT);
+    if (src) {
+        // GL rows run bottom-up, images top-down
+        for (int y = 0; y < image.height; y++) {
+            memcpy((unsigned char *)image.data + y * rowBytes, src + (size_t)(image.height - 1 - y) * rowBytes, rowBytes);
+        }
+        gl.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
     } else {
-        // Undo stack is full, discard
-        for(int i = 0; i < undoAction.numChunks; i++) UnloadImage(undoAction.chunkStates[i].beforeImage);
-        free(undoAction.chunkStates);
+        printf("ERROR: Could not map a GPU readback buffer.\n");
     }
-    
-    // 5. Free the original redo action's images
-    for(int i = 0; i < actionToRedo.numChunks; i++) UnloadImage(actionToRedo.chunkStates[i].beforeImage);
-    free(actionToRedo.chunkStates);
+    gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (req->callback) req->callback(image, src != NULL, req->userData);
 }
 
+// Gives up on a request whose fence can't be waited on, e.g. after the context was lost.
+// Its callback runs with ok false, so the caller can recover or let go of its data.
+static void Readback_Drop(ReadbackRequest *req) {
+    printf("ERROR: Waiting on a GPU readback failed, dropping it.\n");
+    gl.DeleteSync(req->fence);
+    req->fence = NULL;
+    req->busy = false;
+    if (req->image.data != NULL && req->callback) req->callback(req->image, false, req->userData);
+}
 
-void Undo_Destroy(UndoState *undoState) {
-    for (int i = 0; i < undoState->undoCount; i++) {
-        for(int j = 0; j < undoState->undoStack[i].numChunks; j++) {
-            UnloadImage(undoState->undoStack[i].chunkStates[j].beforeImage);
+// Blocks until req's copy has finished and hands it over, or drops it if the wait fails
+static void Readback_Wait(ReadbackRequest *req) {
+    for (;;) {
+        unsigned int status = gl.ClientWaitSync(req->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000ull);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            Readback_Complete(req);
+            return;
+        }
+        if (status == GL_WAIT_FAILED) {
+            Readback_Drop(req);
+            return;
+        }
+    }
+}
+
+void Readback_Shutdown(void) {
+    for (int i = 0; i < READBACK_MAX_BUFFERS; i++) {
+        ReadbackRequest *req = &readbacks[i];
+        // Shutting down, so waiting is fine; callbacks still run to release their data
+        if (req->busy) Readback_Wait(req);
+        if (req->pbo != 0) gl.DeleteBuffers(1, &req->pbo);
+    }
+    memset(readbacks, 0, sizeof(readbacks));
+}
+
+void Readback_Request(RenderTexture2D target, Image image, ReadbackCallback callback, void *userData) {
+    Readback_RequestRegion(target, 0, 0, image, callback, userData);
+}
+
+// Reads the image-sized rectangle at (x, y), counted from the top-left like an Image
+void Readback_RequestRegion(RenderTexture2D target, int x, int y, Image image, ReadbackCallback callback, void *userData) {
+    readbackBytes += (size_t)image.width * image.height * sizeof(Color);
+    ReadbackRequest *req = NULL;
+    if (gl.loaded) {
+        for (int i = 0; i < READBACK_MAX_BUFFERS && req == NULL; i++) {
+            if (!readbacks[i].busy) req = &readbacks[i];
+        }
+    }
+    if (req == NULL && gl.loaded) {
+        // No PBO to spare: read straight into the image and wait for it
+        rlDrawRenderBatchActive();
+        gl.BindFramebuffer(GL_READ_FRAMEBUFFER, target.id);
+        gl.ReadPixels(x, target.texture.height - y - image.height, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, image.data);
+        gl.BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        // GL rows run bottom-up, images top-down; the caller owns image.data, so swap in place
+        size_t rowBytes = (size_t)image.width * sizeof(Color);
+        unsigned char *row = (unsigned char *)malloc(rowBytes);
+        for (int top = 0, bottom = image.height - 1; top < bottom; top++, bottom--) {
+            unsigned char *a = (unsigned char *)image.data + (size_t)top * rowBytes;
+            unsigned char *b = (unsigned char *)image.data + (size_t)bottom * rowBytes;
+            memcpy(row, a, rowBytes);
+            memcpy(a, b, rowBytes);
+            memcpy(b, row, rowBytes);
         }
-        free(undoState->undoStack[i].chunkStates);
+        free(row);
+        if (callback) callback(image, true, userData);
+        return;
+    }
+    if (req == NULL) {
+        // No GL entry points at all: do it the slow way rather than lose the pixels
+        Readback_ReadNow(target, x, y, image);
+        if (callback) callback(image, true, userData);
+        return;
+    }
+
+    rlDrawRenderBatchActive(); // Anything still batched for target has to be drawn first
+    if (req->pbo == 0) {
+        gl.GenBuffers(1, &req->pbo);
+        gl.BindBuffer(GL_PIXEL_PACK_BUFFER, req->pbo);
+        gl.BufferData(GL_PIXEL_PACK_BUFFER, (ptrdiff_t)CHUNK_BYTES, NULL, GL_STREAM_READ);
+    } else {
+        gl.BindBuffer(GL_PIXEL_PACK_BUFFER, req->pbo);
+    }
+    gl.BindFramebuffer(GL_READ_FRAMEBUFFER, target.id);
+    // GL rows count from the bottom
+    gl.ReadPixels(x, target.texture.height - y - image.height, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    gl.BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    req->fence = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    req->image = image;
+    req->callback = callback;
+    req->userData = userData;
+    req->busy = true;
+}
+
+// Reads the image-sized rectangle at (x, y) through raylib, without pixel buffers or
+// fences. Slow and blocking; for when the asynchronous path isn't there or has failed.
+void Readback_ReadNow(RenderTexture2D target, int x, int y, Image image) {
+    Image img = LoadImageFromTexture(target.texture);
+    ImageFlipVertical(&img);
+    size_t rowBytes = (size_t)image.width * sizeof(Color);
+    for (int row = 0; row < image.height; row++) {
+        memcpy((unsigned char *)image.data + row * rowBytes, (Color *)img.data + (size_t)(y + row) * img.width + x, rowBytes);
+    }
+    UnloadImage(img);
+}
+
+void Readback_Poll(void) {
+    for (int i = 0; i < READBACK_MAX_BUFFERS; i++) {
+        ReadbackRequest *req = &readbacks[i];
+        if (!req->busy) continue;
+        unsigned int status = gl.ClientWaitSync(req->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) Readback_Complete(req);
+        else if (status == GL_WAIT_FAILED) Readback_Drop(req);
+    }
+}
+
+// Blocks until the readback into pixels has landed, or failed, and its callback has run
+void Readback_Finish(const void *pixels) {
+    for (int i = 0; i < READBACK_MAX_BUFFERS; i++) {
+        ReadbackRequest *req = &readbacks[i];
+        if (req->busy && req->image.data == pixels) Readback_Wait(req);
+    }
+}
+
+bool Readback_IsPending(const void *pixels) {
+    for (int i = 0; i < READBACK_MAX_BUFFERS; i++) {
+        if (readbacks[i].busy && readbacks[i].image.data == pixels) return true;
+    }
+    return false;
+}
+
+size_t Readback_TotalBytes(void) {
+    return readbackBytes;
+}
+
+// Whether any readback, cancelled ones included, is still waiting on its fence
+bool Readback_Busy(void) {
+    for (int i = 0; i < READBACK_MAX_BUFFERS; i++) {
+        if (readbacks[i].busy) return true;
+    }
+    return false;
+}
+
+void Readback_Cancel(const void *pixels) {
+    for (int i = 0; i < READBACK_MAX_BUFFERS; i++) {
+        // The buffer stays busy until its fence passes, the copy just goes nowhere
+        if (readbacks[i].busy && readbacks[i].image.data == pixels) readbacks[i].image.data = NULL;
+    }
+}
+
+
+//--- Brush Implementations ---
+
+// Stroke segments are capsules. The fragment shader turns the distance to the segment into
+// antialiased coverage, so the size of the brush costs fill rate only and overlapping caps
+// never double-blend. Quads carry their position relative to the segment start in their
+// texture coordinates, so one segment can be drawn into any number of atlas slots in a batch.
+static const char *brushVertexShader =
+    "#version 330\n"
+    "in vec3 vertexPosition;\n"
+    "in vec2 vertexTexCoord;\n"
+    "in vec4 vertexColor;\n"
+    "uniform mat4 mvp;\n"
+    "out vec2 fragPosition;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    fragPosition = vertexTexCoord;\n"
+    "    fragColor = vertexColor;\n"
+    "    gl_Position = mvp * vec4(vertexPosition, 1.0);\n"
+    "}\n";
+
+static const char *brushFragmentShader =
+    "#version 330\n"
+    "in vec2 fragPosition;\n"
+    "in vec4 fragColor;\n"
+    "uniform vec2 segmentEnd;\n"
+    "uniform float radius;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    float h = clamp(dot(fragPosition, segmentEnd) / max(dot(segmentEnd, segmentEnd), 1e-6), 0.0, 1.0);\n"
+    "    float dist = length(fragPosition - segmentEnd * h) - radius;\n"
+    "    float coverage = clamp(0.5 - dist, 0.0, 1.0);\n"
+    "    if (coverage <= 0.0) discard;\n"
+    "    finalColor = vec4(fragColor.rgb, fragColor.a * coverage);\n"
+    "}\n";
+
+static Shader brushShader = { 0 };
+static int brushEndLoc = -1;
+static int brushRadiusLoc = -1;
+static bool brushReady = false;
+static Vector2 brushStart, brushEnd; // Segment between Brush_Begin and Brush_End, in world coordinates
+static float brushRadius;
+
+void Brush_Init(void) {
+    brushShader = LoadShaderFromMemory(brushVertexShader, brushFragmentShader);
+    brushReady = brushShader.id != rlGetShaderIdDefault(); // raylib hands back its default shader on failure
+    if (!brushReady) {
+        printf("WARNING: Brush shader failed to compile, strokes fall back to tessellated lines.\n");
+        return;
+    }
+    brushEndLoc = GetShaderLocation(brushShader, "segmentEnd");
+    brushRadiusLoc = GetShaderLocation(brushShader, "radius");
+}
+
+void Brush_Shutdown(void) {
+    if (brushReady) UnloadShader(brushShader);
+    brushShader = (Shader){ 0 };
+    brushReady = false;
+}
+
+// Starts drawing one segment into the current render target. Every area drawn until
+// Brush_End shares the segment's uniforms and goes out as a single batch.
+void Brush_Begin(Vector2 start, Vector2 end, float radius) {
+    brushStart = start;
+    brushEnd = end;
+    brushRadius = radius;
+    if (!brushReady) return;
+    Vector2 axis = Vector2Subtract(end, start);
+    BeginShaderMode(brushShader); // Flushes earlier geometry, which must not pick up these uniforms
+    SetShaderValue(brushShader, brushEndLoc, &axis, SHADER_UNIFORM_VEC2);
+    SetShaderValue(brushShader, brushRadiusLoc, &radius, SHADER_UNIFORM_FLOAT);
+}
+
+// Covers a world-space area with the segment's capsule, drawn at area + offset in the target
+void Brush_DrawArea(Rectangle area, Vector2 offset, Color color) {
+    float x0 = area.x + offset.x, y0 = area.y + offset.y;
+    float x1 = x0 + area.width, y1 = y0 + area.height;
+    if (!brushReady) {
+        BeginScissorMode((int)floorf(x0), (int)floorf(y0), (int)ceilf(x1) - (int)floorf(x0), (int)ceilf(y1) - (int)floorf(y0));
+            Vector2 start = Vector2Add(brushStart, offset);
+            Vector2 end = Vector2Add(brushEnd, offset);
+            DrawLineEx(start, end, brushRadius * 2.0f, color);
+            DrawCircleV(start, brushRadius, color);
+            DrawCircleV(end, brushRadius, color);
+        EndScissorMode();
+        return;
+    }
+    float u0 = area.x - brushStart.x, v0 = area.y - brushStart.y;
+    float u1 = u0 + area.width, v1 = v0 + area.height;
+    rlSetTexture(rlGetTextureIdDefault());
+    rlBegin(RL_QUADS);
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        rlTexCoord2f(u0, v0); rlVertex2f(x0, y0);
+        rlTexCoord2f(u0, v1); rlVertex2f(x0, y1);
+        rlTexCoord2f(u1, v1); rlVertex2f(x1, y1);
+        rlTexCoord2f(u1, v0); rlVertex2f(x1, y0);
+    rlEnd();
+    rlSetTexture(0);
+}
+
+void Brush_End(void) {
+    if (brushReady) EndShaderMode();
+}
+
+//--- Raster Implementations ---
+
+// CPU counterpart of the brush shader and glyph quads, for chunks that only exist as Image
+// buffers. Coverage and blending run in fixed operation order and integer math, so the SSE2
+// and scalar paths produce identical bytes. Blending matches raylib's BLEND_ALPHA.
+static bool rasterSimd = true;
+
+// Exact round(x / 255) for x <= 255 * 255
+static inline unsigned int Raster_Div255(unsigned int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline unsigned char Raster_CapsuleCoverageAt(float px, float py, Vector2 start, Vector2 axis, float invLengthSq, float radius) {
+    float pax = px - start.x;
+    float pay = py - start.y;
+    float h = (pax * axis.x + pay * axis.y) * invLengthSq;
+    h = fminf(fmaxf(h, 0.0f), 1.0f);
+    float dx = pax - axis.x * h;
+    float dy = pay - axis.y * h;
+    float coverage = 0.5f - (sqrtf(dx * dx + dy * dy) - radius);
+    coverage = fminf(fmaxf(coverage, 0.0f), 1.0f);
+    return (unsigned char)(int)(coverage * 255.0f + 0.5f);
+}
+
+// Coverage of pixels [x0, x0 + count) on the row whose centres sit at py
+static void Raster_CapsuleCoverage(unsigned char *coverage, int x0, int count, float py, Vector2 start, Vector2 end, float radius) {
+    Vector2 axis = { end.x - start.x, end.y - start.y };
+    float invLengthSq = 1.0f / fmaxf(axis.x * axis.x + axis.y * axis.y, 1e-6f);
+    int i = 0;
+#if defined(__SSE2__)
+    if (rasterSimd) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 ax = _mm_set1_ps(axis.x);
+        const __m128 ay = _mm_set1_ps(axis.y);
+        const __m128 inv = _mm_set1_ps(invLengthSq);
+        const __m128 r = _mm_set1_ps(radius);
+        const __m128 pay = _mm_set1_ps(py - start.y);
+        const __m128 steps = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)(x0 + i) + 0.5f), steps);
+            __m128 pax = _mm_sub_ps(px, _mm_set1_ps(start.x));
+            __m128 h = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(pax, ax), _mm_mul_ps(pay, ay)), inv);
+            h = _mm_min_ps(_mm_max_ps(h, zero), one);
+            __m128 dx = _mm_sub_ps(pax, _mm_mul_ps(ax, h));
+            __m128 dy = _mm_sub_ps(pay, _mm_mul_ps(ay, h));
+            __m128 dist = _mm_sub_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))), r);
+            __m128 c = _mm_min_ps(_mm_max_ps(_mm_sub_ps(half, dist), zero), one);
+            __m128i c32 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+            __m128i c16 = _mm_packs_epi32(c32, c32);
+            int packed = _mm_cvtsi128_si32(_mm_packus_epi16(c16, c16));
+            memcpy(coverage + i, &packed, 4);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        coverage[i] = Raster_CapsuleCoverageAt((float)(x0 + i) + 0.5f, py, start, axis, invLengthSq, radius);
     }
-    for (int i = 0; i < undoState->redoCount; i++) {
-        for(int j = 0; j < undoState->redoStack[i].numChunks; j++) {
-            UnloadImage(undoState->redoStack[i].chunkStates[j].beforeImage);
+}
+
+// Blends color into count pixels, each weighted by its coverage
+static void Raster_BlendSpan(Color *pixels, const unsigned char *coverage, int count, Color color) {
+    int i = 0;
+#if defined(__SSE2__)
+    if (rasterSimd) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i full = _mm_set1_epi16(255);
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        const __m128i rgb = _mm_set_epi16(0, color.b, color.g, color.r, 0, color.b, color.g, color.r);
+        const __m128i colorAlpha = _mm_set1_epi16(color.a);
+        for (; i + 4 <= count; i += 4) {
+            int packedCoverage;
+            memcpy(&packedCoverage, coverage + i, 4);
+            if (packedCoverage == 0) continue;
+            __m128i a = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packedCoverage), zero), colorAlpha);
+            a = _mm_add_epi16(a, bias);
+            a = _mm_srli_epi16(_mm_add_epi16(a, _mm_srli_epi16(a, 8)), 8);
+            __m128i pairs = _mm_unpacklo_epi16(a, a);
+            __m128i dst = _mm_loadu_si128((const __m128i *)(pixels + i));
+            __m128i result[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i weight = half ? _mm_unpackhi_epi32(pairs, pairs) : _mm_unpacklo_epi32(pairs, pairs);
+                __m128i d = half ? _mm_unpackhi_epi8(dst, zero) : _mm_unpacklo_epi8(dst, zero);
+                __m128i src = _mm_or_si128(rgb, _mm_and_si128(weight, alphaLanes));
+                __m128i sum = _mm_add_epi16(_mm_mullo_epi16(src, weight), _mm_mullo_epi16(d, _mm_sub_epi16(full, weight)));
+                sum = _mm_add_epi16(sum, bias);
+                result[half] = _mm_srli_epi16(_mm_add_epi16(sum, _mm_srli_epi16(sum, 8)), 8);
+            }
+            _mm_storeu_si128((__m128i *)(pixels + i), _mm_packus_epi16(result[0], result[1]));
         }
-        free(undoState->redoStack[i].chunkStates);
+    }
+#endif
+    for (; i < count; i++) {
+        if (coverage[i] == 0) continue;
+        unsigned int a = Raster_Div255(color.a * coverage[i]);
+        Color *d = &pixels[i];
+        d->r = (unsigned char)Raster_Div255(color.r * a + d->r * (255 - a));
+        d->g = (unsigned char)Raster_Div255(color.g * a + d->g * (255 - a));
+        d->b = (unsigned char)Raster_Div255(color.b * a + d->b * (255 - a));
+        d->a = (unsigned char)Raster_Div255(a * a + d->a * (255 - a));
+    }
+}
+
+// Same capsule as the brush shader, in image coordinates (rows top-down).
+// Returns how many pixels were processed, its bounds clipped to the image.
+int Raster_DrawCapsule(Image *image, Vector2 start, Vector2 end, float radius, Color color) {
+    float extent = radius + 1.0f;
+    int x0 = (int)floorf(fminf(start.x, end.x) - extent);
+    int y0 = (int)floorf(fminf(start.y, end.y) - extent);
+    int x1 = (int)ceilf(fmaxf(start.x, end.x) + extent);
+    int y1 = (int)ceilf(fmaxf(start.y, end.y) + extent);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > image->width) x1 = image->width;
+    if (y1 > image->height) y1 = image->height;
+    if (x0 >= x1 || y0 >= y1) return 0;
+
+    int count = x1 - x0;
+    unsigned char *coverage = (unsigned char *)malloc(count);
+    Color *pixels = (Color *)image->data;
+    for (int y = y0; y < y1; y++) {
+        Raster_CapsuleCoverage(coverage, x0, count, (float)y + 0.5f, start, end, radius);
+        Raster_BlendSpan(pixels + (size_t)y * image->width + x0, coverage, count, color);
+    }
+    free(coverage);
+    return count * (y1 - y0);
+}
+
+// Draws source of an RGBA8 mask stretched over dest, using only its alpha, sampled
+// nearest like the unfiltered font texture. Returns how many pixels were processed.
+int Raster_DrawMask(Image *image, Image mask, Rectangle source, Rectangle dest, Color color) {
+    if (dest.width <= 0.0f || dest.height <= 0.0f) return 0;
+    int x0 = (int)floorf(dest.x), y0 = (int)floorf(dest.y);
+    int x1 = (int)ceilf(dest.x + dest.width), y1 = (int)ceilf(dest.y + dest.height);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > image->width) x1 = image->width;
+    if (y1 > image->height) y1 = image->height;
+    if (x0 >= x1 || y0 >= y1) return 0;
+
+    int count = x1 - x0;
+    unsigned char *coverage = (unsigned char *)malloc(count);
+    const Color *texels = (const Color *)mask.data;
+    float stepX = source.width / dest.width, stepY = source.height / dest.height;
+    for (int y = y0; y < y1; y++) {
+        float v = source.y + ((float)y + 0.5f - dest.y) * stepY;
+        int ty = (int)floorf(v);
+        for (int i = 0; i < count; i++) {
+            float u = source.x + ((float)(x0 + i) + 0.5f - dest.x) * stepX;
+            int tx = (int)floorf(u);
+            bool inside = (float)(x0 + i) + 0.5f >= dest.x && (float)(x0 + i) + 0.5f < dest.x + dest.width &&
+                          (float)y + 0.5f >= dest.y && (float)y + 0.5f < dest.y + dest.height &&
+                          tx >= 0 && ty >= 0 && tx < mask.width && ty < mask.height;
+            coverage[i] = inside ? texels[(size_t)ty * mask.width + tx].a : 0;
+        }
+        Raster_BlendSpan((Color *)image->data + (size_t)y * image->width + x0, coverage, count, color);
+    }
+    free(coverage);
+    return count * (y1 - y0);
+}
+
+// Lays glyph quads out like DrawTextEx. atlas is the font texture as an RGBA8 image.
+void Raster_DrawText(Image *image, Font font, Image atlas, const char *text, Vector2 position, float fontSize, float spacing, Color color) {
+    float scale = fontSize / font.baseSize;
+    float offsetX = 0.0f;
+    int length = (int)strlen(text);
+    for (int i = 0; i < length;) {
+        int codepointSize = 0;
+        int codepoint = GetCodepointNext(&text[i], &codepointSize);
+        int index = GetGlyphIndex(font, codepoint);
+        GlyphInfo glyph = font.glyphs[index];
+        Rectangle rec = font.recs[index];
+        if (codepoint != ' ' && codepoint != '\t') {
+            float padding = (float)font.glyphPadding;
+            Rectangle source = { rec.x - padding, rec.y - padding, rec.width + 2.0f * padding, rec.height + 2.0f * padding };
+            Rectangle dest = {
+                position.x + offsetX + glyph.offsetX * scale - padding * scale,
+                position.y + glyph.offsetY * scale - padding * scale,
+                source.width * scale, source.height * scale
+            };
+            Raster_DrawMask(image, atlas, source, dest, color);
+        }
+        offsetX += ((glyph.advanceX == 0) ? rec.width * scale : glyph.advanceX * scale) + spacing;
+        i += codepointSize;
+    }
+}
+
+static unsigned int Raster_BenchRandom(unsigned int *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static double Raster_BenchRun(bool simd, Image *image, Image mask, int strokes, double *pixels) {
+    rasterSimd = simd;
+    memset(image->data, 0xff, (size_t)image->width * image->height * sizeof(Color));
+    unsigned int seed = 12345;
+    *pixels = 0.0;
+    clock_t start = clock();
+    for (int i = 0; i < strokes; i++) {
+        Vector2 a = { (float)(Raster_BenchRandom(&seed) % 1024), (float)(Raster_BenchRandom(&seed) % 1024) };
+        Vector2 b = { a.x + (float)(Raster_BenchRandom(&seed) % 257) - 128.0f, a.y + (float)(Raster_BenchRandom(&seed) % 257) - 128.0f };
+        float radius = 1.0f + (float)(Raster_BenchRandom(&seed) % 200);
+        unsigned int rgba = Raster_BenchRandom(&seed);
+        Color color = { (unsigned char)rgba, (unsigned char)(rgba >> 8), (unsigned char)(rgba >> 16), (unsigned char)(64 + (rgba >> 10) % 192) };
+        if (i % 4 == 3) {
+            float size = 8.0f + (float)(Raster_BenchRandom(&seed) % 300);
+            Rectangle dest = { a.x - size / 2.0f, a.y - size / 2.0f, size, size };
+            *pixels += Raster_DrawMask(image, mask, (Rectangle){ 0, 0, (float)mask.width, (float)mask.height }, dest, color);
+        } else {
+            *pixels += Raster_DrawCapsule(image, a, b, radius, color);
+        }
+    }
+    rasterSimd = true;
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Headless throughput check of the CPU rasterizer, SIMD against scalar on the same strokes
+int Raster_Benchmark(void) {
+    const int strokes = 4000;
+    Image scalar = AllocChunkImage();
+    Image simd = AllocChunkImage();
+    Image mask = { .data = malloc(64 * 64 * sizeof(Color)), .width = 64, .height = 64, .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, .mipmaps = 1 };
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            float d = sqrtf((float)((x - 32) * (x - 32) + (y - 32) * (y - 32)));
+            ((Color *)mask.data)[y * 64 + x] = (Color){ 255, 255, 255, (unsigned char)Clamp(255.0f - d * 8.0f, 0.0f, 255.0f) };
+        }
+    }
+
+    double scalarPixels, simdPixels;
+    double scalarSeconds = Raster_BenchRun(false, &scalar, mask, strokes, &scalarPixels);
+    double simdSeconds = Raster_BenchRun(true, &simd, mask, strokes, &simdPixels);
+    bool identical = memcmp(scalar.data, simd.data, CHUNK_BYTES) == 0;
+
+    printf("Raster benchmark, %d strokes and glyph quads on a %dx%d chunk:\n", strokes, CHUNK_SIZE, CHUNK_SIZE);
+    printf("  scalar: %.1f MP/s\n", scalarPixels / 1e6 / fmax(scalarSeconds, 1e-9));
+#if defined(__SSE2__)
+    printf("  SSE2:   %.1f MP/s\n", simdPixels / 1e6 / fmax(simdSeconds, 1e-9));
+#else
+    printf("  SIMD:   unavailable in this build\n");
+#endif
+    printf("  outputs %s\n", identical ? "bit-identical" : "DIFFER");
+
+    UnloadImage(scalar);
+    UnloadImage(simd);
+    UnloadImage(mask);
+    return identical ? 0 : 1;
+}
+
+//--- Compression Implementations ---
+// Chunks are mostly one flat colour, so a plain run-length code does well.
+// The stream is a sequence of packets, each a little-endian 16-bit header:
+// high bit set means the next Color repeats (header & 0x7FFF) + 1 times,
+// clear means (header + 1) literal Colors follow.
+
+static bool SameColor(Color a, Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+// Returns the encoded size, or 0 if the stream wouldn't fit in capacity
+size_t Rle_Encode(const Color *pixels, int count, unsigned char *out, size_t capacity) {
+    size_t size = 0;
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && run < RLE_MAX_RUN && SameColor(pixels[i + run], pixels[i])) run++;
+        int literal = 0;
+        if (run < 2) {
+            // Extend the literal until the next run of two starts
+            literal = 1;
+            while (i + literal < count && literal < RLE_MAX_RUN &&
+                   !(i + literal + 1 < count && SameColor(pixels[i + literal], pixels[i + literal + 1]))) literal++;
+        }
+        int n = literal ? literal : run;
+        size_t payload = literal ? (size_t)literal * sizeof(Color) : sizeof(Color);
+        if (size + 2 + payload > capacity) return 0;
+        unsigned int header = (unsigned int)(n - 1) | (literal ? 0 : 0x8000u);
+        out[size++] = (unsigned char)(header & 0xFF);
+        out[size++] = (unsigned char)(header >> 8);
+        memcpy(out + size, &pixels[i], payload);
+        size += payload;
+        i += n;
+    }
+    return size;
+}
+
+bool Rle_Decode(const unsigned char *in, size_t size, Color *pixels, int count) {
+    size_t pos = 0;
+    int i = 0;
+    while (i < count) {
+        if (pos + 2 > size) return false;
+        unsigned int header = in[pos] | (in[pos + 1] << 8);
+        pos += 2;
+        int n = (int)(header & 0x7FFF) + 1;
+        if (i + n > count) return false;
+        if (header & 0x8000u) {
+            if (pos + sizeof(Color) > size) return false;
+            Color c;
+            memcpy(&c, in + pos, sizeof(Color));
+            pos += sizeof(Color);
+            for (int j = 0; j < n; j++) pixels[i + j] = c;
+        } else {
+            if (pos + (size_t)n * sizeof(Color) > size) return false;
+            memcpy(&pixels[i], in + pos, (size_t)n * sizeof(Color));
+            pos += (size_t)n * sizeof(Color);
+        }
+        i += n;
+    }
+    return true;
+}
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;     // Work queued or shutting down
+    pthread_cond_t finished; // A job moved to the done list
+    CompressJob *queueHead, *queueTail;
+    CompressJob *done;
+    int inFlight;            // Submitted but not yet finished
+    bool running;
+    bool stopping;
+} compressor;
+
+static void *Compress_Worker(void *arg) {
+    (void)arg;
+    unsigned char *scratch = (unsigned char*)malloc(CHUNK_BYTES);
+    pthread_mutex_lock(&compressor.lock);
+    for (;;) {
+        while (compressor.queueHead == NULL && !compressor.stopping) pthread_cond_wait(&compressor.wake, &compressor.lock);
+        CompressJob *job = compressor.queueHead;
+        if (job == NULL) break;
+        compressor.queueHead = job->next;
+        if (compressor.queueHead == NULL) compressor.queueTail = NULL;
+        pthread_mutex_unlock(&compressor.lock);
+
+        // Anything that doesn't come out smaller than raw stays raw
+        size_t size = Rle_Encode(job->pixels, CHUNK_SIZE * CHUNK_SIZE, scratch, CHUNK_BYTES - 1);
+        if (size > 0) {
+            job->packed = (unsigned char*)malloc(size);
+            memcpy(job->packed, scratch, size);
+            job->packedSize = size;
+        }
+
+        pthread_mutex_lock(&compressor.lock);
+        job->next = compressor.done;
+        compressor.done = job;
+        compressor.inFlight--;
+        pthread_cond_broadcast(&compressor.finished);
+    }
+    pthread_mutex_unlock(&compressor.lock);
+    free(scratch);
+    return NULL;
+}
+
+void Compress_Init(void) {
+    memset(&compressor, 0, sizeof(compressor));
+    pthread_mutex_init(&compressor.lock, NULL);
+    pthread_cond_init(&compressor.wake, NULL);
+    pthread_cond_init(&compressor.finished, NULL);
+    compressor.running = pthread_create(&compressor.thread, NULL, Compress_Worker, NULL) == 0;
+    if (!compressor.running) printf("WARNING: Could not start the compression thread, cached chunks will stay raw.\n");
+}
+
+void Compress_Shutdown(void) {
+    if (compressor.running) {
+        pthread_mutex_lock(&compressor.lock);
+        compressor.stopping = true;
+        pthread_cond_signal(&compressor.wake);
+        pthread_mutex_unlock(&compressor.lock);
+        pthread_join(compressor.thread, NULL);
+    }
+    // Only orphaned jobs are left at this point
+    CompressJob *job = compressor.done;
+    while (job) {
+        CompressJob *next = job->next;
+        if (job->orphaned) free((void*)job->pixels);
+        free(job->packed);
+        free(job);
+        job = next;
+    }
+    pthread_cond_destroy(&compressor.finished);
+    pthread_cond_destroy(&compressor.wake);
+    pthread_mutex_destroy(&compressor.lock);
+    memset(&compressor, 0, sizeof(compressor));
+}
+
+// Queues pixels for compression. Returns NULL if there is no worker to do it.
+CompressJob *Compress_Submit(const Color *pixels, int cacheIndex) {
+    if (!compressor.running) return NULL;
+    CompressJob *job = (CompressJob*)calloc(1, sizeof(CompressJob));
+    job->pixels = pixels;
+    job->cacheIndex = cacheIndex;
+    pthread_mutex_lock(&compressor.lock);
+    if (compressor.queueTail) compressor.queueTail->next = job;
+    else compressor.queueHead = job;
+    compressor.queueTail = job;
+    compressor.inFlight++;
+    pthread_cond_signal(&compressor.wake);
+    pthread_mutex_unlock(&compressor.lock);
+    return job;
+}
+
+// Hands back every job finished since the last call, as a list linked through next
+CompressJob *Compress_TakeFinished(void) {
+    if (!compressor.running) return NULL;
+    pthread_mutex_lock(&compressor.lock);
+    CompressJob *done = compressor.done;
+    compressor.done = NULL;
+    pthread_mutex_unlock(&compressor.lock);
+    return done;
+}
+
+// Blocks until every submitted job has finished
+void Compress_Flush(void) {
+    if (!compressor.running) return;
+    pthread_mutex_lock(&compressor.lock);
+    while (compressor.inFlight > 0) pthread_cond_wait(&compressor.finished, &compressor.lock);
+    pthread_mutex_unlock(&compressor.lock);
+}
+
+bool Compress_Busy(void) {
+    if (!compressor.running) return false;
+    pthread_mutex_lock(&compressor.lock);
+    bool busy = compressor.inFlight > 0;
+    pthread_mutex_unlock(&compressor.lock);
+    return busy;
+}
+
+
+//--- Spill File Implementations ---
+
+static int FileSeek(FILE *file, long long offset) {
+#if defined(_WIN32)
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+int Spill_Write(SpillFile *spill, const void *pixels) {
+    if (spill->file == NULL) {
+        spill->file = tmpfile(); // Removed automatically when closed
+        if (spill->file == NULL) return -1;
+    }
+    int slot = (spill->freeCount > 0) ? spill->freeSlots[--spill->freeCount] : spill->slotCount++;
+    if (FileSeek(spill->file, (long long)slot * CHUNK_BYTES) != 0 || fwrite(pixels, 1, CHUNK_BYTES, spill->file) != CHUNK_BYTES) {
+        Spill_Free(spill, slot);
+        return -1;
+    }
+    return slot;
+}
+
+bool Spill_Read(SpillFile *spill, int slot, void *pixels) {
+    if (spill->file == NULL || FileSeek(spill->file, (long long)slot * CHUNK_BYTES) != 0) return false;
+    return fread(pixels, 1, CHUNK_BYTES, spill->file) == CHUNK_BYTES;
+}
+
+void Spill_Free(SpillFile *spill, int slot) {
+    if (spill->freeCount == spill->freeCapacity) {
+        spill->freeCapacity = spill->freeCapacity ? spill->freeCapacity * 2 : 64;
+        spill->freeSlots = (int*)realloc(spill->freeSlots, spill->freeCapacity * sizeof(int));
+    }
+    spill->freeSlots[spill->freeCount++] = slot;
+}
+
+void Spill_Reset(SpillFile *spill) {
+    // The file itself is kept and simply overwritten from the start
+    spill->slotCount = 0;
+    spill->freeCount = 0;
+}
+
+void Spill_Close(SpillFile *spill) {
+    if (spill->file) fclose(spill->file);
+    free(spill->freeSlots);
+    *spill = (SpillFile){0};
+}
+
+
+//--- Save File Implementations ---
+
+static long long FileTell(FILE *file) {
+#if defined(_WIN32)
+    return _ftelli64(file);
+#else
+    return (long long)ftello(file);
+#endif
+}
+
+static bool FileTruncate(FILE *file, long long size) {
+    fflush(file);
+#if defined(_WIN32)
+    return _chsize_s(_fileno(file), size) == 0;
+#else
+    return ftruncate(fileno(file), (off_t)size) == 0;
+#endif
+}
+
+uint32_t Crc32(const void *data, size_t size) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+    const unsigned char *bytes = (const unsigned char*)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+bool SaveWriter_Open(SaveWriter *writer, const char *path) {
+    *writer = (SaveWriter){0};
+    writer->file = fopen(path, "wb");
+    writer->appendStart = -1;
+    if (writer->file == NULL) return false;
+    unsigned int magic = SAVE_FILE_MAGIC;
+    unsigned int version = SAVE_FILE_VERSION;
+    fwrite(&magic, sizeof(unsigned int), 1, writer->file);
+    fwrite(&version, sizeof(unsigned int), 1, writer->file);
+    writer->scratch = (unsigned char*)malloc(CHUNK_BYTES);
+    return true;
+}
+
+// Continues a v2 file: new blobs and a fresh index go after the old index,
+// which stays in place until a compaction drops it
+bool SaveWriter_Append(SaveWriter *writer, const char *path) {
+    *writer = (SaveWriter){0};
+    writer->file = fopen(path, "r+b");
+    if (writer->file == NULL) return false;
+    if (fseek(writer->file, 0, SEEK_END) != 0 || (writer->appendStart = FileTell(writer->file)) < 0) {
+        fclose(writer->file);
+        return false;
+    }
+    writer->scratch = (unsigned char*)malloc(CHUNK_BYTES);
+    return true;
+}
+
+static void SaveWriter_Reserve(SaveWriter *writer) {
+    if (writer->count == writer->capacity) {
+        writer->capacity = writer->capacity ? writer->capacity * 2 : 64;
+        writer->index = (SaveIndexEntry*)realloc(writer->index, writer->capacity * sizeof(SaveIndexEntry));
+    }
+}
+
+// Indexes a blob already in the file being appended to
+void SaveWriter_AddExisting(SaveWriter *writer, const SaveIndexEntry *entry) {
+    SaveWriter_Reserve(writer);
+    writer->index[writer->count++] = *entry;
+}
+
+bool SaveWriter_AddBlob(SaveWriter *writer, int x, int y, const unsigned char *blob, size_t length) {
+    SaveWriter_Reserve(writer);
+    long long offset = FileTell(writer->file);
+    if (offset < 0 || fwrite(blob, 1, length, writer->file) != length) return false;
+    writer->index[writer->count++] = (SaveIndexEntry){
+        .x = x, .y = y,
+        .offset = (uint64_t)offset,
+        .length = (uint32_t)length,
+        .checksum = Crc32(blob, length)
+    };
+    return true;
+}
+
+bool SaveWriter_AddPixels(SaveWriter *writer, int x, int y, const Color *pixels) {
+    size_t size = Rle_Encode(pixels, CHUNK_SIZE * CHUNK_SIZE, writer->scratch, CHUNK_BYTES - 1);
+    if (size == 0) return SaveWriter_AddBlob(writer, x, y, (const unsigned char*)pixels, CHUNK_BYTES);
+    return SaveWriter_AddBlob(writer, x, y, writer->scratch, size);
+}
+
+// Writes the index and trailer if keep is set, then closes the file. Returns whether the
+// file was completed. An append that wasn't is cut back to where it started, which puts
+// the previous trailer back at the end.
+bool SaveWriter_Close(SaveWriter *writer, bool keep) {
+    bool ok = keep;
+    if (keep) {
+        SaveTrailer trailer = {
+            .indexOffset = (uint64_t)FileTell(writer->file),
+            .count = (uint32_t)writer->count,
+            .magic = SAVE_FILE_INDEX_MAGIC
+        };
+        ok = fwrite(writer->index, sizeof(SaveIndexEntry), writer->count, writer->file) == (size_t)writer->count;
+        ok = ok && fwrite(&trailer, sizeof(SaveTrailer), 1, writer->file) == 1;
+        ok = ok && fflush(writer->file) == 0;
+    }
+    if (!ok && writer->appendStart >= 0 && !FileTruncate(writer->file, writer->appendStart)) {
+        printf("WARNING: Could not undo a failed append, the save file ends in a partial write.\n");
+    }
+    ok = (fclose(writer->file) == 0) && ok;
+    free(writer->index);
+    free(writer->scratch);
+    *writer = (SaveWriter){0};
+    return ok;
+}
+
+// Checks the magic and returns a version this build can read
+bool SaveFile_ReadHeader(FILE *file, unsigned int *version) {
+    unsigned int magic;
+    if (fread(&magic, sizeof(unsigned int), 1, file) != 1 || fread(version, sizeof(unsigned int), 1, file) != 1) return false;
+    return magic == SAVE_FILE_MAGIC && *version >= 1 && *version <= SAVE_FILE_VERSION;
+}
+
+// Offset of the last trailer in the file that directly follows the index it points at, or -1.
+// Normally that is the one at the very end; the search runs back from there in blocks.
+static long long SaveFile_FindTrailer(FILE *file, SaveTrailer *trailer) {
+    enum { BLOCK = 1 << 16 };
+    if (fseek(file, 0, SEEK_END) != 0) return -1;
+    long long headerSize = 2 * sizeof(unsigned int);
+    long long hi = FileTell(file) - (long long)sizeof(SaveTrailer); // Last candidate offset
+    unsigned char *buffer = (unsigned char*)malloc(BLOCK + sizeof(SaveTrailer));
+    long long found = -1;
+    while (hi >= headerSize && found < 0) {
+        long long lo = (hi - BLOCK + 1 > headerSize) ? hi - BLOCK + 1 : headerSize;
+        size_t length = (size_t)(hi - lo) + sizeof(SaveTrailer);
+        if (FileSeek(file, lo) != 0 || fread(buffer, 1, length, file) != length) break;
+        for (long long at = hi; at >= lo && found < 0; at--) {
+            uint32_t magic;
+            memcpy(&magic, buffer + (at - lo) + offsetof(SaveTrailer, magic), sizeof(magic));
+            if (magic != SAVE_FILE_INDEX_MAGIC) continue;
+            memcpy(trailer, buffer + (at - lo), sizeof(SaveTrailer));
+            if (trailer->indexOffset >= (uint64_t)headerSize &&
+                trailer->indexOffset + (uint64_t)trailer->count * sizeof(SaveIndexEntry) == (uint64_t)at) found = at;
+        }
+        hi = lo - 1;
+    }
+    free(buffer);
+    return found;
+}
+
+// Reads the index the trailer at the end of the file points at. If the end was torn by a
+// crash during an append, the index of the last save that finished is used instead.
+bool SaveFile_ReadIndex(FILE *file, SaveIndexEntry **entries, int *count) {
+    SaveTrailer trailer;
+    long long trailerOffset = SaveFile_FindTrailer(file, &trailer);
+    if (trailerOffset < 0) return false;
+    if (fseek(file, 0, SEEK_END) == 0 && FileTell(file) != trailerOffset + (long long)sizeof(SaveTrailer)) {
+        printf("WARNING: Save file ends in an unfinished write, loading the last complete save before it.\n");
+    }
+
+    *entries = (SaveIndexEntry*)malloc((trailer.count ? trailer.count : 1) * sizeof(SaveIndexEntry));
+    if (FileSeek(file, (long long)trailer.indexOffset) != 0 ||
+        fread(*entries, sizeof(SaveIndexEntry), trailer.count, file) != trailer.count) {
+        free(*entries);
+        *entries = NULL;
+        return false;
+    }
+    *count = (int)trailer.count;
+    return true;
+}
+
+// Reads and verifies one blob. Returns NULL if it is unreadable or fails its checksum.
+unsigned char *SaveFile_ReadBlob(FILE *file, const SaveIndexEntry *entry) {
+    if (entry->length == 0 || entry->length > CHUNK_BYTES) return NULL;
+    unsigned char *blob = (unsigned char*)malloc(entry->length);
+    if (FileSeek(file, (long long)entry->offset) != 0 || fread(blob, 1, entry->length, file) != entry->length ||
+        Crc32(blob, entry->length) != entry->checksum) {
+        free(blob);
+        return NULL;
+    }
+    return blob;
+}
+
+// Rewrites a v1 save as v2
+bool SaveFile_Convert(const char *inPath, const char *outPath) {
+    FILE *in = fopen(inPath, "rb");
+    if (!in) {
+        printf("ERROR: Could not open file '%s' for reading.\n", inPath);
+        return false;
+    }
+    unsigned int version;
+    if (!SaveFile_ReadHeader(in, &version) || version != 1) {
+        printf("ERROR: '%s' is not a version 1 save file.\n", inPath);
+        fclose(in);
+        return false;
+    }
+    SaveWriter writer;
+    if (!SaveWriter_Open(&writer, outPath)) {
+        printf("ERROR: Could not open file '%s' for writing.\n", outPath);
+        fclose(in);
+        return false;
+    }
+
+    Color *pixels = (Color*)malloc(CHUNK_BYTES);
+    bool ok = true;
+    for (;;) {
+        Vector2 gridPos;
+        if (fread(&gridPos, sizeof(Vector2), 1, in) != 1) break;
+        if (fread(pixels, sizeof(Color), CHUNK_SIZE * CHUNK_SIZE, in) != CHUNK_SIZE * CHUNK_SIZE) break;
+        // Later duplicates are ignored on load, so only the first copy is kept
+        bool duplicate = false;
+        for (int i = 0; i < writer.count && !duplicate; i++) {
+            duplicate = writer.index[i].x == (int)gridPos.x && writer.index[i].y == (int)gridPos.y;
+        }
+        if (!duplicate) ok = ok && SaveWriter_AddPixels(&writer, (int)gridPos.x, (int)gridPos.y, pixels);
+    }
+    free(pixels);
+    fclose(in);
+
+    int count = writer.count;
+    ok = SaveWriter_Close(&writer, ok);
+    if (ok) printf("Converted %d chunks from '%s' to '%s'\n", count, inPath, outPath);
+    else printf("ERROR: Failed writing '%s'.\n", outPath);
+    return ok;
+}
+
+
+// v1 records are a fixed size, so their index can be built by hopping from header to header
+static bool SaveSource_ScanV1(SaveSource *source) {
+    const long long stride = (long long)sizeof(Vector2) + (long long)CHUNK_BYTES;
+    fseek(source->file, 0, SEEK_END);
+    long long size = FileTell(source->file);
+    int count = (int)((size - 2 * (long long)sizeof(unsigned int)) / stride);
+    source->index = (SaveIndexEntry*)malloc((count > 0 ? count : 1) * sizeof(SaveIndexEntry));
+    for (int i = 0; i < count; i++) {
+        long long offset = 2 * (long long)sizeof(unsigned int) + i * stride;
+        Vector2 gridPos;
+        if (FileSeek(source->file, offset) != 0 || fread(&gridPos, sizeof(Vector2), 1, source->file) != 1) return false;
+        source->index[i] = (SaveIndexEntry){
+            .x = (int32_t)gridPos.x, .y = (int32_t)gridPos.y,
+            .offset = (uint64_t)(offset + (long long)sizeof(Vector2)),
+            .length = (uint32_t)CHUNK_BYTES
+        };
+        source->count = i + 1;
+    }
+    return true;
+}
+
+bool SaveSource_Open(SaveSource *source, const char *path) {
+    *source = (SaveSource){0};
+    snprintf(source->path, sizeof(source->path), "%s", path);
+    source->file = fopen(path, "rb");
+    if (source->file == NULL) return false;
+    bool ok = SaveFile_ReadHeader(source->file, &source->version);
+    if (ok && source->version == 1) ok = SaveSource_ScanV1(source);
+    else if (ok) ok = SaveFile_ReadIndex(source->file, &source->index, &source->count);
+    if (!ok) {
+        SaveSource_Close(source);
+        return false;
+    }
+    for (int i = 0; i < source->count; i++) source->liveBytes += source->index[i].length;
+    fseek(source->file, 0, SEEK_END);
+    long long size = FileTell(source->file);
+    source->fileSize = (uint64_t)size;
+#if !defined(_WIN32)
+    void *map = (size > 0) ? mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(source->file), 0) : MAP_FAILED;
+    if (map != MAP_FAILED) {
+        source->map = (const unsigned char*)map;
+        source->mapSize = (size_t)size;
+    }
+#endif
+    // Without a mapping, blobs are read through the file handle instead
+    return true;
+}
+
+void SaveSource_Close(SaveSource *source) {
+#if !defined(_WIN32)
+    if (source->map) munmap((void*)source->map, source->mapSize);
+#endif
+    if (source->file) fclose(source->file);
+    free(source->index);
+    *source = (SaveSource){0};
+}
+
+// Decodes chunk i of the index into pixels, verifying its checksum where the format has one
+bool SaveSource_Fetch(SaveSource *source, int i, Color *pixels) {
+    const SaveIndexEntry *entry = &source->index[i];
+    if (source->version == 1) {
+        if (source->map) {
+            if (entry->offset + CHUNK_BYTES > source->mapSize) return false;
+            memcpy(pixels, source->map + entry->offset, CHUNK_BYTES);
+            return true;
+        }
+        return FileSeek(source->file, (long long)entry->offset) == 0 && fread(pixels, 1, CHUNK_BYTES, source->file) == CHUNK_BYTES;
+    }
+
+    const unsigned char *blob = NULL;
+    unsigned char *owned = NULL;
+    if (source->map) {
+        if (entry->length == 0 || entry->length > CHUNK_BYTES || entry->offset + entry->length > source->mapSize) return false;
+        blob = source->map + entry->offset;
+        if (Crc32(blob, entry->length) != entry->checksum) return false;
+    } else {
+        blob = owned = SaveFile_ReadBlob(source->file, entry);
+        if (blob == NULL) return false;
+    }
+    bool ok = true;
+    if (entry->length == CHUNK_BYTES) memcpy(pixels, blob, CHUNK_BYTES);
+    else ok = Rle_Decode(blob, entry->length, pixels, CHUNK_SIZE * CHUNK_SIZE);
+    free(owned);
+    return ok;
+}
+
+
+static void *SaveCompaction_Worker(void *arg) {
+    SaveCompaction *compaction = (SaveCompaction*)arg;
+    bool ok = false;
+    FILE *in = fopen(compaction->path, "rb");
+    SaveWriter writer;
+    if (in && SaveWriter_Open(&writer, compaction->tempPath)) {
+        ok = true;
+        for (int i = 0; i < compaction->count && ok; i++) {
+            const SaveIndexEntry *entry = &compaction->index[i];
+            unsigned char *blob = SaveFile_ReadBlob(in, entry);
+            ok = blob && SaveWriter_AddBlob(&writer, entry->x, entry->y, blob, entry->length);
+            free(blob);
+        }
+        ok = SaveWriter_Close(&writer, ok);
+    }
+    if (in) fclose(in);
+
+    pthread_mutex_lock(&compaction->lock);
+    compaction->ok = ok;
+    compaction->finished = true;
+    pthread_mutex_unlock(&compaction->lock);
+    return NULL;
+}
+
+// Copies the live blobs of path into path.compact on a background thread.
+// Takes a copy of index, so the caller may replace its own while this runs.
+bool SaveCompaction_Start(SaveCompaction *compaction, const char *path, const SaveIndexEntry *index, int count) {
+    *compaction = (SaveCompaction){0};
+    snprintf(compaction->path, sizeof(compaction->path), "%s", path);
+    snprintf(compaction->tempPath, sizeof(compaction->tempPath), "%s.compact", path);
+    compaction->index = (SaveIndexEntry*)malloc((count ? count : 1) * sizeof(SaveIndexEntry));
+    memcpy(compaction->index, index, count * sizeof(SaveIndexEntry));
+    compaction->count = count;
+    pthread_mutex_init(&compaction->lock, NULL);
+    compaction->running = pthread_create(&compaction->thread, NULL, SaveCompaction_Worker, compaction) == 0;
+    if (!compaction->running) {
+        pthread_mutex_destroy(&compaction->lock);
+        free(compaction->index);
+        compaction->index = NULL;
+    }
+    return compaction->running;
+}
+
+// Returns true once the worker has finished and been joined; ok then holds the outcome
+bool SaveCompaction_Poll(SaveCompaction *compaction, bool wait) {
+    if (!compaction->running) return false;
+    if (!wait) {
+        pthread_mutex_lock(&compaction->lock);
+        bool finished = compaction->finished;
+        pthread_mutex_unlock(&compaction->lock);
+        if (!finished) return false;
+    }
+    pthread_join(compaction->thread, NULL);
+    pthread_mutex_destroy(&compaction->lock);
+    compaction->running = false;
+    return true;
+}
+
+
+//--- Chunk Atlas Implementations ---
+
+// Each instance is one chunk: a unit quad scaled to the chunk, placed at its world
+// position and sampling its slot of the page bound for the call.
+static const char *atlasVertexShader =
+    "#version 330\n"
+    "layout(location = 0) in vec2 vertexPosition;\n"
+    "layout(location = 1) in vec4 instanceChunk;\n" // World top-left, slot origin in the page
+    "uniform mat4 mvp;\n"
+    "uniform float chunkSize;\n"
+    "uniform float pageSize;\n"
+    "out vec2 fragTexCoord;\n"
+    "void main() {\n"
+    "    vec2 texel = instanceChunk.zw + vertexPosition * chunkSize;\n"
+    "    fragTexCoord = vec2(texel.x, pageSize - texel.y) / pageSize;\n" // Pages are stored bottom-up
+    "    gl_Position = mvp * vec4(instanceChunk.xy + vertexPosition * chunkSize, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *atlasFragmentShader =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "uniform sampler2D texture0;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    finalColor = texture(texture0, fragTexCoord);\n"
+    "}\n";
+
+static void Atlas_InitDraw(ChunkAtlas *atlas) {
+    atlas->drawShader = LoadShaderFromMemory(atlasVertexShader, atlasFragmentShader);
+    if (atlas->drawShader.id == rlGetShaderIdDefault()) {
+        printf("WARNING: Atlas shader failed to compile, chunks are drawn one by one.\n");
+        return;
+    }
+    atlas->drawVao = rlLoadVertexArray();
+    if (atlas->drawVao == 0) {
+        printf("WARNING: No vertex array objects, chunks are drawn one by one.\n");
+        UnloadShader(atlas->drawShader);
+        return;
+    }
+    float chunkSize = (float)CHUNK_SIZE, pageSize = (float)ATLAS_PAGE_SIZE;
+    atlas->drawMvpLoc = GetShaderLocation(atlas->drawShader, "mvp");
+    SetShaderValue(atlas->drawShader, GetShaderLocation(atlas->drawShader, "chunkSize"), &chunkSize, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(atlas->drawShader, GetShaderLocation(atlas->drawShader, "pageSize"), &pageSize, SHADER_UNIFORM_FLOAT);
+
+    // Same corner order as raylib's own quads, so face culling treats them alike
+    static const float quad[12] = { 0, 0,  0, 1,  1, 1,  0, 0,  1, 1,  1, 0 };
+    int maxInstances = atlas->maxPages * ATLAS_SLOTS_PER_PAGE;
+    rlEnableVertexArray(atlas->drawVao);
+        atlas->quadVbo = rlLoadVertexBuffer(quad, sizeof(quad), false);
+        rlSetVertexAttribute(0, 2, RL_FLOAT, false, 0, 0);
+        rlEnableVertexAttribute(0);
+        atlas->instanceVbo = rlLoadVertexBuffer(NULL, maxInstances * 4 * sizeof(float), true);
+        rlSetVertexAttribute(1, 4, RL_FLOAT, false, 0, 0);
+        rlEnableVertexAttribute(1);
+        rlSetVertexAttributeDivisor(1, 1);
+    rlDisableVertexArray();
+    atlas->drawReady = true;
+}
+
+// Room for slotCount chunks; pages are only created once slots on them are needed
+void Atlas_Init(ChunkAtlas *atlas, int slotCount) {
+    *atlas = (ChunkAtlas){ 0 };
+    atlas->maxPages = (slotCount + ATLAS_SLOTS_PER_PAGE - 1) / ATLAS_SLOTS_PER_PAGE;
+    atlas->pages = (RenderTexture2D*)calloc(atlas->maxPages, sizeof(RenderTexture2D));
+    atlas->freeSlots = (int*)malloc(atlas->maxPages * ATLAS_SLOTS_PER_PAGE * sizeof(int));
+    atlas->instances = (float*)malloc((size_t)atlas->maxPages * ATLAS_SLOTS_PER_PAGE * 4 * sizeof(float));
+    atlas->pageInstances = (int*)calloc(atlas->maxPages, sizeof(int));
+    Atlas_InitDraw(atlas);
+}
+
+void Atlas_Destroy(ChunkAtlas *atlas) {
+    for (int i = 0; i < atlas->pageCount; i++) UnloadColorRenderTexture(atlas->pages[i]);
+    if (atlas->drawReady) {
+        rlUnloadVertexBuffer(atlas->quadVbo);
+        rlUnloadVertexBuffer(atlas->instanceVbo);
+        rlUnloadVertexArray(atlas->drawVao);
+        UnloadShader(atlas->drawShader);
+    }
+    free(atlas->pages);
+    free(atlas->freeSlots);
+    free(atlas->instances);
+    free(atlas->pageInstances);
+    *atlas = (ChunkAtlas){ 0 };
+}
+
+// Returns a free slot, or -1 if every page is full
+int Atlas_Acquire(ChunkAtlas *atlas) {
+    if (atlas->freeCount == 0) {
+        if (atlas->pageCount == atlas->maxPages) return -1;
+        int page = atlas->pageCount++;
+        atlas->pages[page] = LoadColorRenderTexture(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        // Pushed in reverse so slots are handed out from the top-left
+        for (int i = ATLAS_SLOTS_PER_PAGE - 1; i >= 0; i--) atlas->freeSlots[atlas->freeCount++] = page * ATLAS_SLOTS_PER_PAGE + i;
+    }
+    return atlas->freeSlots[--atlas->freeCount];
+}
+
+void Atlas_Release(ChunkAtlas *atlas, int slot) {
+    atlas->freeSlots[atlas->freeCount++] = slot;
+}
+
+RenderTexture2D Atlas_Page(const ChunkAtlas *atlas, int slot) {
+    return atlas->pages[slot / ATLAS_SLOTS_PER_PAGE];
+}
+
+// Top-left corner of the slot in its page, counted like an Image
+Vector2 Atlas_SlotOrigin(int slot) {
+    int index = slot % ATLAS_SLOTS_PER_PAGE;
+    return (Vector2){ (float)((index % ATLAS_PAGE_CHUNKS) * CHUNK_SIZE), (float)((index / ATLAS_PAGE_CHUNKS) * CHUNK_SIZE) };
+}
+
+// Source rectangle for drawing the slot upright. Render textures are stored bottom-up.
+Rectangle Atlas_SlotSource(int slot) {
+    Vector2 origin = Atlas_SlotOrigin(slot);
+    return (Rectangle){ origin.x, (float)ATLAS_PAGE_SIZE - origin.y - CHUNK_SIZE, (float)CHUNK_SIZE, -(float)CHUNK_SIZE };
+}
+
+// BeginTextureMode on a page, counted for the HUD
+void Atlas_BeginPage(ChunkAtlas *atlas, int page) {
+    atlas->binds++;
+    BeginTextureMode(atlas->pages[page]);
+}
+
+// Replaces a slot's contents with a chunk image (top row first)
+void Atlas_Upload(ChunkAtlas *atlas, int slot, const Color *pixels) {
+    Color *flipped = (Color*)malloc(CHUNK_BYTES);
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        memcpy(flipped + (size_t)y * CHUNK_SIZE, pixels + (size_t)(CHUNK_SIZE - 1 - y) * CHUNK_SIZE, CHUNK_SIZE * sizeof(Color));
+    }
+    Vector2 origin = Atlas_SlotOrigin(slot);
+    Rectangle rec = { origin.x, (float)ATLAS_PAGE_SIZE - origin.y - CHUNK_SIZE, (float)CHUNK_SIZE, (float)CHUNK_SIZE };
+    UpdateTextureRec(Atlas_Page(atlas, slot).texture, rec, flipped);
+    free(flipped);
+}
+
+void Atlas_Clear(ChunkAtlas *atlas, int slot, Color color) {
+    Vector2 origin = Atlas_SlotOrigin(slot);
+    Atlas_BeginPage(atlas, slot / ATLAS_SLOTS_PER_PAGE);
+        DrawRectangle((int)origin.x, (int)origin.y, CHUNK_SIZE, CHUNK_SIZE, color);
+    EndTextureMode();
+}
+
+// Draws the instances gathered in atlas->instances with the current 2D camera,
+// one instanced call per page that has any
+void Atlas_DrawInstances(ChunkAtlas *atlas) {
+    rlDrawRenderBatchActive(); // Whatever was batched before belongs underneath
+    Matrix mvp = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+    rlEnableShader(atlas->drawShader.id);
+    rlSetUniformMatrix(atlas->drawMvpLoc, mvp);
+    rlEnableVertexArray(atlas->drawVao);
+    rlActiveTextureSlot(0);
+    for (int page = 0; page < atlas->pageCount; page++) {
+        int count = atlas->pageInstances[page];
+        if (count == 0) continue;
+        const float *instances = atlas->instances + (size_t)page * ATLAS_SLOTS_PER_PAGE * 4;
+        rlUpdateVertexBuffer(atlas->instanceVbo, instances, count * 4 * sizeof(float), 0);
+        rlEnableTexture(atlas->pages[page].texture.id);
+        rlDrawVertexArrayInstanced(0, 6, count);
+    }
+    rlDisableTexture();
+    rlDisableVertexArray();
+    rlDisableShader();
+}
+
+//--- Render Target Pool Implementations ---
+
+static RenderTargetPool renderPool = { 0 };
+
+static size_t RenderPool_TargetBytes(RenderTexture2D target) {
+    return (size_t)target.texture.width * target.texture.height * sizeof(Color);
+}
+
+// Render target with a colour texture only. LoadRenderTexture also attaches a depth
+// renderbuffer of the same size, which nothing drawn on the canvas ever uses.
+RenderTexture2D LoadColorRenderTexture(int width, int height) {
+    RenderTexture2D target = { 0 };
+    target.id = rlLoadFramebuffer();
+    if (target.id == 0) return LoadRenderTexture(width, height);
+    target.texture = (Texture2D){
+        .id = rlLoadTexture(NULL, width, height, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, 1),
+        .width = width,
+        .height = height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+    };
+    rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+    if (!rlFramebufferComplete(target.id)) {
+        printf("WARNING: Colour-only framebuffer is incomplete, using one with a depth buffer.\n");
+        UnloadRenderTexture(target);
+        return LoadRenderTexture(width, height);
+    }
+    renderPool.depthBytesSaved += (size_t)width * height * RENDER_TARGET_DEPTH_BYTES;
+    return target;
+}
+
+// Unloads a target from LoadColorRenderTexture, whichever way it was created
+void UnloadColorRenderTexture(RenderTexture2D target) {
+    if (target.id != 0 && target.depth.id == 0) {
+        renderPool.depthBytesSaved -= (size_t)target.texture.width * target.texture.height * RENDER_TARGET_DEPTH_BYTES;
+    }
+    UnloadRenderTexture(target);
+}
+
+// A render target of the given size. Its contents are whatever was left in it, so
+// callers overwrite or clear it.
+RenderTexture2D RenderPool_Acquire(int width, int height) {
+    // Newest first: the most recently released targets are the likeliest to be warm
+    for (int i = renderPool.count - 1; i >= 0; i--) {
+        RenderTexture2D target = renderPool.targets[i];
+        if (target.texture.width != width || target.texture.height != height) continue;
+        memmove(&renderPool.targets[i], &renderPool.targets[i + 1], (renderPool.count - i - 1) * sizeof(RenderTexture2D));
+        renderPool.count--;
+        renderPool.bytes -= RenderPool_TargetBytes(target);
+        return target;
+    }
+    return LoadColorRenderTexture(width, height);
+}
+
+void RenderPool_Release(RenderTexture2D target) {
+    if (target.id == 0) return;
+    if (renderPool.count == renderPool.capacity) {
+        renderPool.capacity = renderPool.capacity ? renderPool.capacity * 2 : 16;
+        renderPool.targets = (RenderTexture2D*)realloc(renderPool.targets, renderPool.capacity * sizeof(RenderTexture2D));
+    }
+    renderPool.targets[renderPool.count++] = target;
+    renderPool.bytes += RenderPool_TargetBytes(target);
+
+    const size_t spare = (size_t)RENDER_POOL_SPARE_MB * 1024 * 1024;
+    int dropped = 0;
+    while (renderPool.bytes > spare && dropped < renderPool.count) {
+        renderPool.bytes -= RenderPool_TargetBytes(renderPool.targets[dropped]);
+        UnloadColorRenderTexture(renderPool.targets[dropped++]);
+    }
+    if (dropped > 0) {
+        renderPool.count -= dropped;
+        memmove(renderPool.targets, renderPool.targets + dropped, renderPool.count * sizeof(RenderTexture2D));
+    }
+}
+
+size_t RenderPool_SpareBytes(void) {
+    return renderPool.bytes;
+}
+
+size_t RenderPool_DepthBytesSaved(void) {
+    return renderPool.depthBytesSaved;
+}
+
+void RenderPool_Shutdown(void) {
+    for (int i = 0; i < renderPool.count; i++) UnloadColorRenderTexture(renderPool.targets[i]);
+    free(renderPool.targets);
+    renderPool = (RenderTargetPool){ 0 };
+}
+
+
+//--- Chunk Directory Implementations ---
+
+static unsigned int ChunkDir_Hash(int x, int y) {
+    unsigned int h = (unsigned int)x * 0x9E3779B1u;
+    h ^= (unsigned int)y * 0x85EBCA77u + 0x7F4A7C15u + (h << 6) + (h >> 2);
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    return h;
+}
+
+void ChunkDir_Init(ChunkDirectory *dir, int capacity) {
+    int cap = 16;
+    while (cap < capacity) cap <<= 1;
+    dir->entries = (ChunkEntry*)calloc(cap, sizeof(ChunkEntry));
+    dir->capacity = cap;
+    dir->count = 0;
+    dir->used = 0;
+}
+
+void ChunkDir_Destroy(ChunkDirectory *dir) {
+    free(dir->entries);
+    *dir = (ChunkDirectory){0};
+}
+
+void ChunkDir_Clear(ChunkDirectory *dir) {
+    memset(dir->entries, 0, dir->capacity * sizeof(ChunkEntry));
+    dir->count = 0;
+    dir->used = 0;
+}
+
+ChunkEntry* ChunkDir_Find(ChunkDirectory *dir, int x, int y) {
+    unsigned int mask = (unsigned int)dir->capacity - 1;
+    for (unsigned int i = ChunkDir_Hash(x, y) & mask;; i = (i + 1) & mask) {
+        ChunkEntry *e = &dir->entries[i];
+        if (e->state == CHUNK_ENTRY_EMPTY) return NULL;
+        if (e->state == CHUNK_ENTRY_USED && e->x == x && e->y == y) return e;
+    }
+}
+
+// Rebuilds the table at the given capacity, dropping tombstones on the way
+static void ChunkDir_Rehash(ChunkDirectory *dir, int capacity) {
+    ChunkEntry *old = dir->entries;
+    int oldCapacity = dir->capacity;
+    dir->entries = (ChunkEntry*)calloc(capacity, sizeof(ChunkEntry));
+    dir->capacity = capacity;
+    dir->used = dir->count;
+    unsigned int mask = (unsigned int)capacity - 1;
+    for (int j = 0; j < oldCapacity; j++) {
+        if (old[j].state != CHUNK_ENTRY_USED) continue;
+        unsigned int i = ChunkDir_Hash(old[j].x, old[j].y) & mask;
+        while (dir->entries[i].state != CHUNK_ENTRY_EMPTY) i = (i + 1) & mask;
+        dir->entries[i] = old[j];
+    }
+    free(old);
+}
+
+ChunkEntry* ChunkDir_Insert(ChunkDirectory *dir, int x, int y) {
+    ChunkEntry *existing = ChunkDir_Find(dir, x, y);
+    if (existing) return existing;
+
+    // Keep the load factor (tombstones included) under 70% so probes stay short
+    if ((dir->used + 1) * 10 > dir->capacity * 7) {
+        int capacity = dir->capacity;
+        if ((dir->count + 1) * 10 > capacity * 5) capacity <<= 1;
+        ChunkDir_Rehash(dir, capacity);
+    }
+
+    unsigned int mask = (unsigned int)dir->capacity - 1;
+    unsigned int i = ChunkDir_Hash(x, y) & mask;
+    while (dir->entries[i].state == CHUNK_ENTRY_USED) i = (i + 1) & mask;
+    ChunkEntry *e = &dir->entries[i];
+    if (e->state == CHUNK_ENTRY_EMPTY) dir->used++;
+    *e = (ChunkEntry){ .x = x, .y = y, .poolIndex = -1, .cacheIndex = -1, .diskIndex = -1, .fileIndex = -1, .state = CHUNK_ENTRY_USED };
+    dir->count++;
+    return e;
+}
+
+void ChunkDir_RemoveIfUnused(ChunkDirectory *dir, ChunkEntry *entry) {
+    if (entry == NULL || entry->poolIndex >= 0 || entry->cacheIndex >= 0 || entry->diskIndex >= 0 || entry->evicting || entry->fileIndex >= 0) return;
+    entry->state = CHUNK_ENTRY_TOMBSTONE;
+    dir->count--;
+}
+
+// Times the lookups Canvas_Update makes each frame, one per cell of a pool-sized
+// window, against directories holding 10k, 100k and 1M chunks. The window pans
+// diagonally across the painted square and past its edge, so misses are timed too.
+int ChunkDir_Benchmark(void) {
+    const int sizes[] = { 10000, 100000, 1000000 };
+    const int frames = 20000;
+    const int diameter = (CHUNK_POOL_RADIUS * 2) + 1;
+    bool ok = true;
+
+    printf("Chunk directory benchmark, %dx%d chunk window, %d frames:\n", diameter, diameter, frames);
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        ChunkDirectory dir;
+        ChunkDir_Init(&dir, 64);
+        int side = (int)ceil(sqrt((double)sizes[s]));
+        for (int i = 0; i < sizes[s]; i++) {
+            ChunkDir_Insert(&dir, i % side - side / 2, i / side - side / 2)->poolIndex = 0;
+        }
+
+        long long hits = 0;
+        int span = side + diameter;
+        clock_t start = clock();
+        for (int f = 0; f < frames; f++) {
+            int minX = f % span - side / 2 - diameter;
+            int minY = (f * 7) % span - side / 2 - diameter;
+            for (int y = minY; y < minY + diameter; y++) {
+                for (int x = minX; x < minX + diameter; x++) {
+                    if (ChunkDir_Find(&dir, x, y) != NULL) hits++;
+                }
+            }
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        // Cross-check the hit count against the filled square
+        long long expected = 0;
+        for (int f = 0; f < frames; f++) {
+            int minX = f % span - side / 2 - diameter;
+            int minY = (f * 7) % span - side / 2 - diameter;
+            for (int y = minY; y < minY + diameter; y++) {
+                for (int x = minX; x < minX + diameter; x++) {
+                    int i = (y + side / 2) * side + (x + side / 2);
+                    if (x >= -side / 2 && x < side - side / 2 && y >= -side / 2 && i < sizes[s]) expected++;
+                }
+            }
+        }
+        if (hits != expected) ok = false;
+
+        double lookups = (double)frames * diameter * diameter;
+        printf("  %7d chunks: %.2f us/frame, %.1f ns/lookup, %.0f%% hits, %.1f MiB table\n",
+               sizes[s], seconds * 1e6 / frames, seconds * 1e9 / lookups, 100.0 * hits / lookups,
+               dir.capacity * sizeof(ChunkEntry) / (1024.0 * 1024.0));
+        ChunkDir_Destroy(&dir);
+    }
+    printf("  lookups %s\n", ok ? "match the filled chunks" : "MISSED chunks");
+    return ok ? 0 : 1;
+}
+
+
+//--- LOD Pyramid Implementations ---
+
+static int FloorDiv(int a, int b) {
+    int q = a / b;
+    if ((a % b != 0) && (a < 0)) q--;
+    return q;
+}
+
+void Lod_Init(LodPyramid *lod) {
+    *lod = (LodPyramid){0};
+    for (int level = 1; level < LOD_LEVELS; level++) ChunkDir_Init(&lod->levels[level], 64);
+    lod->slots = (LodSlot*)calloc(LOD_POOL_SIZE, sizeof(LodSlot));
+}
+
+void Lod_Clear(LodPyramid *lod) {
+    for (int i = 0; i < lod->tileCount; i++) UnloadImage(lod->tiles[i].image);
+    lod->tileCount = 0;
+    lod->tileBytes = 0;
+    for (int level = 1; level < LOD_LEVELS; level++) ChunkDir_Clear(&lod->levels[level]);
+    // Slot textures are kept around and reused by the next uploads
+    for (int i = 0; i < LOD_POOL_SIZE; i++) lod->slots[i].active = false;
+}
+
+void Lod_Destroy(LodPyramid *lod) {
+    Lod_Clear(lod);
+    for (int i = 0; i < LOD_POOL_SIZE; i++) {
+        if (lod->slots[i].texture.id != 0) UnloadTexture(lod->slots[i].texture);
+    }
+    free(lod->slots);
+    free(lod->tiles);
+    free(lod->scratch);
+    for (int level = 1; level < LOD_LEVELS; level++) ChunkDir_Destroy(&lod->levels[level]);
+}
+
+int Lod_LevelForZoom(float zoom) {
+    // Stay on a level until its tiles would be magnified on screen
+    int level = 0;
+    while (level < LOD_LEVELS - 1 && zoom * (float)(1 << (level + 1)) < 1.0f) level++;
+    return level;
+}
+
+// Box-filters src down to half its size: size x size pixels of output, rows stride pixels apart
+static void Lod_Halve(const Color *src, int srcStride, Color *dst, int dstStride, int size) {
+    for (int j = 0; j < size; j++) {
+        const Color *row0 = src + (size_t)(2 * j) * srcStride;
+        const Color *row1 = row0 + srcStride;
+        Color *out = dst + (size_t)j * dstStride;
+        for (int i = 0; i < size; i++) {
+            Color a = row0[2*i], b = row0[2*i + 1], c = row1[2*i], d = row1[2*i + 1];
+            out[i] = (Color){
+                (unsigned char)((a.r + b.r + c.r + d.r + 2) >> 2),
+                (unsigned char)((a.g + b.g + c.g + d.g + 2) >> 2),
+                (unsigned char)((a.b + b.b + c.b + d.b + 2) >> 2),
+                (unsigned char)((a.a + b.a + c.a + d.a + 2) >> 2)
+            };
+        }
+    }
+}
+
+// Records that something has been drawn in the chunk at gridPos, so the tiles over it aren't blank
+void Lod_MarkContent(LodPyramid *lod, Vector2 gridPos) {
+    int x = (int)gridPos.x, y = (int)gridPos.y;
+    for (int level = 1; level < LOD_LEVELS; level++) {
+        ChunkDir_Insert(&lod->levels[level], FloorDiv(x, 1 << level), FloorDiv(y, 1 << level));
+    }
+}
+
+// Box-filters a chunk's pixels into its footprint on every level that has a tile in RAM.
+// Each level is built from the one below, so the work is about 4/3 of a single pass.
+// Tiles not in RAM pick the pixels up from the chunk when they are next built.
+void Lod_UpdateFromImage(LodPyramid *lod, Vector2 gridPos, Image image) {
+    int x = (int)gridPos.x, y = (int)gridPos.y;
+    Lod_MarkContent(lod, gridPos);
+    LodTile *tiles[LOD_LEVELS] = { 0 };
+    int top = 0; // Highest level with a tile to update
+    for (int level = 1; level < LOD_LEVELS; level++) {
+        ChunkEntry *entry = ChunkDir_Find(&lod->levels[level], FloorDiv(x, 1 << level), FloorDiv(y, 1 << level));
+        if (entry->cacheIndex < 0) continue;
+        tiles[level] = &lod->tiles[entry->cacheIndex];
+        if (entry->poolIndex >= 0) lod->slots[entry->poolIndex].stale = true;
+        top = level;
+    }
+    if (top == 0) return;
+
+    int half = CHUNK_SIZE / 2;
+    if (lod->scratch == NULL) lod->scratch = (Color *)malloc((size_t)(half * half + half * half / 4) * sizeof(Color));
+    Color *scratch[2] = { lod->scratch, lod->scratch + half * half }; // Alternate levels, halving in size
+    const Color *src = (const Color *)image.data;
+    int srcStride = CHUNK_SIZE;
+    for (int level = 1; level <= top; level++) {
+        int span = 1 << level;
+        int size = CHUNK_SIZE >> level;
+        Color *dst = scratch[(level - 1) & 1];
+        int dstStride = size;
+        if (tiles[level]) {
+            int tileX = FloorDiv(x, span), tileY = FloorDiv(y, span);
+            dst = (Color *)tiles[level]->image.data + (y - tileY * span) * size * CHUNK_SIZE + (x - tileX * span) * size;
+            dstStride = CHUNK_SIZE;
+        }
+        Lod_Halve(src, srcStride, dst, dstStride, size);
+        src = dst;
+        srcStride = dstStride;
+    }
+}
+
+// Builds the tile at level, x, y by halving the four cells under it, top-left first in
+// rows: the given chunk pixels at level 1 (NULL where blank), otherwise the tiles one
+// level down, any of which that have content must be in RAM already
+void Lod_BuildTile(LodPyramid *lod, int level, int x, int y, const Color *chunks[4]) {
+    ChunkEntry *entry = ChunkDir_Insert(&lod->levels[level], x, y);
+    if (lod->tileCount == lod->tileCapacity) {
+        lod->tileCapacity = lod->tileCapacity ? lod->tileCapacity * 2 : 64;
+        lod->tiles = (LodTile*)realloc(lod->tiles, lod->tileCapacity * sizeof(LodTile));
+    }
+    entry->cacheIndex = lod->tileCount++;
+    LodTile *tile = &lod->tiles[entry->cacheIndex];
+    *tile = (LodTile){ .image = GenImageColor(CHUNK_SIZE, CHUNK_SIZE, RAYWHITE), .level = level, .x = x, .y = y, .lastUsedFrame = lod->frame };
+    lod->tileBytes += CHUNK_BYTES;
+    int half = CHUNK_SIZE / 2;
+    for (int i = 0; i < 4; i++) {
+        const Color *src = (level == 1) ? chunks[i] : NULL;
+        if (level > 1) {
+            ChunkEntry *child = ChunkDir_Find(&lod->levels[level - 1], 2 * x + (i & 1), 2 * y + (i >> 1));
+            if (child && child->cacheIndex >= 0) src = (const Color *)lod->tiles[child->cacheIndex].image.data;
+        }
+        if (src == NULL) continue;
+        Color *dst = (Color *)tile->image.data + (i >> 1) * half * CHUNK_SIZE + (i & 1) * half;
+        Lod_Halve(src, CHUNK_SIZE, dst, CHUNK_SIZE, half);
+    }
+    if (entry->poolIndex >= 0) lod->slots[entry->poolIndex].stale = true;
+}
+
+// Drops the least recently used tiles beyond LOD_CACHE_BUDGET_MB. Tiles used this frame,
+// on screen or for building one, stay even if that means going over.
+void Lod_EnforceBudget(LodPyramid *lod) {
+    while (lod->tileBytes > (size_t)LOD_CACHE_BUDGET_MB * 1024 * 1024) {
+        int victim = -1;
+        for (int i = 0; i < lod->tileCount; i++) {
+            if (lod->tiles[i].lastUsedFrame == lod->frame) continue;
+            if (victim < 0 || lod->tiles[i].lastUsedFrame < lod->tiles[victim].lastUsedFrame) victim = i;
+        }
+        if (victim < 0) return;
+        LodTile *tile = &lod->tiles[victim];
+        ChunkDir_Find(&lod->levels[tile->level], tile->x, tile->y)->cacheIndex = -1;
+        UnloadImage(tile->image);
+        lod->tileBytes -= CHUNK_BYTES;
+        *tile = lod->tiles[--lod->tileCount]; // Last tile takes the freed place
+        if (victim < lod->tileCount) ChunkDir_Find(&lod->levels[tile->level], tile->x, tile->y)->cacheIndex = victim;
+    }
+}
+
+static void Lod_ReleaseSlot(LodPyramid *lod, int index) {
+    LodSlot *slot = &lod->slots[index];
+    ChunkEntry *entry = ChunkDir_Find(&lod->levels[slot->level], slot->x, slot->y);
+    if (entry) entry->poolIndex = -1;
+    slot->active = false;
+}
+
+// Keeps GPU textures for exactly the non-blank tiles in view at the chosen level that have
+// been built. Returns whether any tile on screen was added, dropped or re-uploaded.
+bool Lod_UpdateResidency(LodPyramid *lod, int level, Rectangle worldView) {
+    bool changed = false;
+    lod->frame++;
+    lod->level = level;
+    if (level > 0) {
+        float span = (float)(CHUNK_SIZE << level);
+        lod->minX = (int)floorf(worldView.x / span);
+        lod->minY = (int)floorf(worldView.y / span);
+        lod->maxX = (int)floorf((worldView.x + worldView.width) / span);
+        lod->maxY = (int)floorf((worldView.y + worldView.height) / span);
+    }
+
+    for (int i = 0; i < LOD_POOL_SIZE; i++) {
+        LodSlot *slot = &lod->slots[i];
+        if (!slot->active) continue;
+        if (level == 0 || slot->level != level || slot->x < lod->minX || slot->x > lod->maxX || slot->y < lod->minY || slot->y > lod->maxY) {
+            Lod_ReleaseSlot(lod, i);
+            changed = true;
+        }
+    }
+    if (level == 0) return changed;
+
+    int freeSlot = 0;
+    for (int y = lod->minY; y <= lod->maxY; y++) {
+        for (int x = lod->minX; x <= lod->maxX; x++) {
+            ChunkEntry *entry = ChunkDir_Find(&lod->levels[level], x, y);
+            // Blank, or not built yet (see Canvas_BuildLod): covered by the background
+            if (entry == NULL || entry->cacheIndex < 0) continue;
+            lod->tiles[entry->cacheIndex].lastUsedFrame = lod->frame;
+            if (entry->poolIndex < 0) {
+                while (freeSlot < LOD_POOL_SIZE && lod->slots[freeSlot].active) freeSlot++;
+                if (freeSlot == LOD_POOL_SIZE) {
+                    printf("WARNING: LOD pool is full! Could not show tile (%d, %d) at level %d.\n", x, y, level);
+                    return changed;
+                }
+                entry->poolIndex = freeSlot;
+                lod->slots[freeSlot] = (LodSlot){ .texture = lod->slots[freeSlot].texture, .level = level, .x = x, .y = y, .active = true, .stale = true };
+            }
+            LodSlot *slot = &lod->slots[entry->poolIndex];
+            if (slot->stale) {
+                Image image = lod->tiles[entry->cacheIndex].image;
+                if (slot->texture.id == 0) {
+                    slot->texture = LoadTextureFromImage(image);
+                    SetTextureFilter(slot->texture, TEXTURE_FILTER_BILINEAR);
+                } else {
+                    UpdateTexture(slot->texture, image.data);
+                }
+                slot->stale = false;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+
+//--- Undo/Redo Implementations ---
+
+// Undo images may still be waiting on a readback, which must not land in freed memory
+static void Undo_UnloadImage(Image image) {
+    Readback_Cancel(image.data);
+    UnloadImage(image);
+}
+
+static size_t Undo_RegionBytes(const UndoRegion *region) {
+    return (size_t)region->width * region->height * sizeof(Color);
+}
+
+static void Undo_FreeAction(UndoState *undoState, UndoAction *action) {
+    for (int i = 0; i < action->numChunks; i++) {
+        UndoChunkState *state = &action->chunkStates[i];
+        for (int r = 0; r < state->numRegions; r++) {
+            UndoRegion *region = &state->regions[r];
+            if (region->texture.id != 0) {
+                RenderPool_Release(region->texture);
+                undoState->gpuBytes -= Undo_RegionBytes(region);
+            } else {
+                Undo_UnloadImage(region->image);
+            }
+        }
+        free(state->regions);
+    }
+    free(action->chunkStates);
+    *action = (UndoAction){0};
+}
+
+static Image Undo_AllocRegionImage(int width, int height) {
+    return (Image){
+        .data = malloc((size_t)width * height * sizeof(Color)),
+        .width = width,
+        .height = height,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        .mipmaps = 1
+    };
+}
+
+static bool Undo_IsTileCaptured(const UndoChunkState *state, int tx, int ty) {
+    int bit = ty * UNDO_TILES_PER_SIDE + tx;
+    return (state->captured[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void Undo_MarkTileCaptured(UndoChunkState *state, int tx, int ty) {
+    int bit = ty * UNDO_TILES_PER_SIDE + tx;
+    state->captured[bit / 8] |= (unsigned char)(1 << (bit % 8));
+}
+
+// Copies rows between a region-sized image and the matching rectangle of a chunk image
+static void Undo_CopyRegionPixels(Image chunkImage, const UndoRegion *region, Image regionImage, bool toChunk) {
+    size_t rowBytes = (size_t)region->width * sizeof(Color);
+    for (int row = 0; row < region->height; row++) {
+        Color *chunkRow = (Color*)chunkImage.data + (size_t)(region->y + row) * CHUNK_SIZE + region->x;
+        Color *regionRow = (Color*)regionImage.data + (size_t)row * region->width;
+        if (toChunk) memcpy(chunkRow, regionRow, rowBytes);
+        else memcpy(regionRow, chunkRow, rowBytes);
+    }
+}
+
+// Snapshots a tile-aligned rectangle of the chunk as it is right now. Resident chunks are
+// blitted into a texture of their own while VRAM allows, otherwise read back to RAM;
+// chunks outside the pool are copied from their cached pixels.
+static void Undo_CaptureRegion(Canvas *canvas, UndoChunkState *state, CanvasChunk *chunk, CachedChunk *cached, int x, int y, int width, int height) {
+    UndoState *undoState = &canvas->undoState;
+    state->numRegions++;
+    state->regions = (UndoRegion*)realloc(state->regions, state->numRegions * sizeof(UndoRegion));
+    UndoRegion *region = &state->regions[state->numRegions - 1];
+    *region = (UndoRegion){ .x = x, .y = y, .width = width, .height = height };
+    if (cached) {
+        region->image = Undo_AllocRegionImage(width, height);
+        Undo_CopyRegionPixels(cached->image, region, region->image, false);
+        return;
+    }
+    RenderTexture2D page = chunk ? Atlas_Page(&canvas->atlas, chunk->slot) : (RenderTexture2D){ 0 };
+    Vector2 origin = chunk ? Atlas_SlotOrigin(chunk->slot) : (Vector2){ 0 };
+    if (chunk && UNDO_VRAM_BUDGET_MB > 0) {
+        region->texture = RenderPool_Acquire(width, height);
+        if (GLExt_BlitRegion(page, (int)origin.x + x, (int)origin.y + y, region->texture, 0, 0, width, height)) {
+            undoState->gpuBytes += Undo_RegionBytes(region);
+            return;
+        }
+        RenderPool_Release(region->texture);
+        region->texture = (RenderTexture2D){ 0 };
+    }
+    region->image = Undo_AllocRegionImage(width, height);
+    if (chunk) Readback_RequestRegion(page, (int)origin.x + x, (int)origin.y + y, region->image, NULL, NULL);
+}
+
+// Moves a GPU snapshot to RAM. The texture can be reused right away, GL finishes the read first.
+static void Undo_MigrateRegion(UndoState *undoState, UndoRegion *region) {
+    region->image = Undo_AllocRegionImage(region->width, region->height);
+    Readback_Request(region->texture, region->image, NULL, NULL);
+    RenderPool_Release(region->texture);
+    region->texture = (RenderTexture2D){ 0 };
+    undoState->gpuBytes -= Undo_RegionBytes(region);
+}
+
+// Moves an action's GPU snapshots to RAM in capture order until VRAM use is within budget
+static bool Undo_MigrateAction(UndoState *undoState, UndoAction *action, size_t budget) {
+    for (int c = 0; c < action->numChunks; c++) {
+        UndoChunkState *state = &action->chunkStates[c];
+        for (int r = 0; r < state->numRegions; r++) {
+            if (undoState->gpuBytes <= budget) return true;
+            if (state->regions[r].texture.id != 0) Undo_MigrateRegion(undoState, &state->regions[r]);
+        }
+    }
+    return undoState->gpuBytes <= budget;
+}
+
+static bool Undo_MigrateRing(UndoState *undoState, UndoRing *ring, size_t budget) {
+    for (int i = 0; i < ring->count; i++) {
+        if (Undo_MigrateAction(undoState, &ring->items[(ring->start + i) & (ring->capacity - 1)], budget)) return true;
+    }
+    return undoState->gpuBytes <= budget;
+}
+
+// Keeps GPU snapshots within UNDO_VRAM_BUDGET_MB, moving the least likely to be needed
+// to RAM first: the oldest undo steps, then the farthest redo steps, and finally the
+// earliest regions of the action being recorded, for a stroke that outgrows the budget alone
+static void Undo_EnforceVramBudget(UndoState *undoState) {
+    const size_t budget = (size_t)UNDO_VRAM_BUDGET_MB * 1024 * 1024;
+    if (undoState->gpuBytes <= budget) return;
+    if (Undo_MigrateRing(undoState, &undoState->undo, budget)) return;
+    if (Undo_MigrateRing(undoState, &undoState->redo, budget)) return;
+    if (undoState->currentAction) Undo_MigrateAction(undoState, undoState->currentAction, budget);
+}
+
+static size_t Undo_ActionBytes(const UndoAction *action) {
+    size_t bytes = action->numChunks * sizeof(UndoChunkState);
+    for (int i = 0; i < action->numChunks; i++) {
+        for (int r = 0; r < action->chunkStates[i].numRegions; r++) {
+            bytes += sizeof(UndoRegion) + Undo_RegionBytes(&action->chunkStates[i].regions[r]);
+        }
+    }
+    return bytes;
+}
+
+static void UndoRing_Push(UndoRing *ring, UndoAction action) {
+    if (ring->count == ring->capacity) {
+        // Grow and unwrap so the oldest action lands at index 0
+        int capacity = ring->capacity ? ring->capacity * 2 : 64;
+        UndoAction *items = (UndoAction*)malloc(capacity * sizeof(UndoAction));
+        for (int i = 0; i < ring->count; i++) items[i] = ring->items[(ring->start + i) & (ring->capacity - 1)];
+        free(ring->items);
+        ring->items = items;
+        ring->capacity = capacity;
+        ring->start = 0;
+    }
+    ring->items[(ring->start + ring->count) & (ring->capacity - 1)] = action;
+    ring->count++;
+}
+
+static UndoAction *UndoRing_Newest(UndoRing *ring) {
+    return &ring->items[(ring->start + ring->count - 1) & (ring->capacity - 1)];
+}
+
+static UndoAction UndoRing_PopNewest(UndoRing *ring) {
+    UndoAction action = *UndoRing_Newest(ring);
+    ring->count--;
+    return action;
+}
+
+static UndoAction UndoRing_PopOldest(UndoRing *ring) {
+    UndoAction action = ring->items[ring->start];
+    ring->start = (ring->start + 1) & (ring->capacity - 1);
+    ring->count--;
+    return action;
+}
+
+static void Undo_PushAction(UndoState *undoState, UndoRing *ring, UndoAction action) {
+    action.bytes = Undo_ActionBytes(&action);
+    undoState->bytes += action.bytes;
+    UndoRing_Push(ring, action);
+}
+
+static UndoAction Undo_PopAction(UndoState *undoState, UndoRing *ring) {
+    UndoAction action = UndoRing_PopNewest(ring);
+    undoState->bytes -= action.bytes;
+    return action;
+}
+
+// Drops the oldest history until it fits the budget. The newest undo step is
+// always kept, so even an oversized stroke can be taken back.
+static void Undo_EnforceBudget(UndoState *undoState) {
+    const size_t budget = (size_t)UNDO_BUDGET_MB * 1024 * 1024;
+    while (undoState->bytes > budget) {
+        UndoRing *ring = (undoState->undo.count > 1) ? &undoState->undo : &undoState->redo;
+        if (ring->count == 0) break;
+        UndoAction oldest = UndoRing_PopOldest(ring);
+        undoState->bytes -= oldest.bytes;
+        Undo_FreeAction(undoState, &oldest);
+    }
+}
+
+void Undo_BeginAction(UndoState *undoState) {
+    if (undoState->currentAction != NULL) {
+        // This case should ideally not happen if EndAction is always called.
+        // But as a safeguard, we can end the previous action.
+        Undo_EndAction(undoState);
+    }
+    undoState->currentAction = (UndoAction*)calloc(1, sizeof(UndoAction));
+}
+
+// The world-space shape an edit is about to cover: a rectangle, or a stroke segment
+// when radius is above zero
+typedef struct UndoShape {
+    Rectangle bounds;
+    Vector2 start, end;
+    float radius;
+} UndoShape;
+
+static bool Undo_ShapeTouches(const UndoShape *shape, Rectangle rec) {
+    if (shape->radius <= 0.0f) return true; // Anything inside the bounds
+    return CheckCollisionCapsuleRec(shape->start, shape->end, shape->radius + UNDO_CAPTURE_PADDING, rec);
+}
+
+// Whether row's flagged tiles from first to last form a run on their own
+static bool Undo_RowRunIs(const bool *row, int first, int last) {
+    if (first > 0 && row[first - 1]) return false;
+    if (last < UNDO_TILES_PER_SIDE - 1 && row[last + 1]) return false;
+    for (int tx = first; tx <= last; tx++) {
+        if (!row[tx]) return false;
+    }
+    return true;
+}
+
+// Captures the tiles flagged in want and marks them captured. Each run of flagged tiles in a
+// row becomes a region, taking in the rows below that have the same run, so a rectangle is
+// one region and a diagonal stroke a thin staircase of them.
+static void Undo_CaptureTiles(Canvas *canvas, UndoChunkState *state, CanvasChunk *chunk, CachedChunk *cached, bool want[UNDO_TILES_PER_SIDE][UNDO_TILES_PER_SIDE]) {
+    for (int ty = 0; ty < UNDO_TILES_PER_SIDE; ty++) {
+        int tx = 0;
+        while (tx < UNDO_TILES_PER_SIDE) {
+            if (!want[ty][tx]) { tx++; continue; }
+            int first = tx;
+            while (tx < UNDO_TILES_PER_SIDE && want[ty][tx]) tx++;
+            int last = tx - 1;
+            int bottom = ty;
+            while (bottom + 1 < UNDO_TILES_PER_SIDE && Undo_RowRunIs(want[bottom + 1], first, last)) bottom++;
+            for (int y = ty; y <= bottom; y++) {
+                for (int x = first; x <= last; x++) {
+                    want[y][x] = false;
+                    Undo_MarkTileCaptured(state, x, y);
+                }
+            }
+            Undo_CaptureRegion(canvas, state, chunk, cached, first * UNDO_TILE_SIZE, ty * UNDO_TILE_SIZE,
+                               (last - first + 1) * UNDO_TILE_SIZE, (bottom - ty + 1) * UNDO_TILE_SIZE);
+        }
+    }
+}
+
+static void Undo_AddShapeToCurrentAction(Canvas *canvas, UndoState *undoState, const UndoShape *shape) {
+    UndoAction *action = undoState->currentAction;
+    if (action == NULL) return;
+    Rectangle worldRect = shape->bounds;
+
+    float minX = worldRect.x - UNDO_CAPTURE_PADDING;
+    float minY = worldRect.y - UNDO_CAPTURE_PADDING;
+    float maxX = worldRect.x + worldRect.width + UNDO_CAPTURE_PADDING;
+    float maxY = worldRect.y + worldRect.height + UNDO_CAPTURE_PADDING;
+    Vector2 minGrid = WorldToGrid((Vector2){ minX, minY });
+    Vector2 maxGrid = WorldToGrid((Vector2){ maxX, maxY });
+
+    for (int gy = (int)minGrid.y; gy <= (int)maxGrid.y; gy++) {
+        for (int gx = (int)minGrid.x; gx <= (int)maxGrid.x; gx++) {
+            Vector2 gridPos = { (float)gx, (float)gy };
+            int tx0 = (int)Clamp(floorf((minX - gx * CHUNK_SIZE) / UNDO_TILE_SIZE), 0, UNDO_TILES_PER_SIDE - 1);
+            int ty0 = (int)Clamp(floorf((minY - gy * CHUNK_SIZE) / UNDO_TILE_SIZE), 0, UNDO_TILES_PER_SIDE - 1);
+            int tx1 = (int)Clamp(floorf((maxX - gx * CHUNK_SIZE) / UNDO_TILE_SIZE), 0, UNDO_TILES_PER_SIDE - 1);
+            int ty1 = (int)Clamp(floorf((maxY - gy * CHUNK_SIZE) / UNDO_TILE_SIZE), 0, UNDO_TILES_PER_SIDE - 1);
+
+            UndoChunkState *state = NULL;
+            for (int i = 0; i < action->numChunks && state == NULL; i++) {
+                if (Vector2Equals(action->chunkStates[i].gridPos, gridPos)) state = &action->chunkStates[i];
+            }
+
+            // Tiles the shape reaches that haven't been captured yet
+            bool want[UNDO_TILES_PER_SIDE][UNDO_TILES_PER_SIDE] = { { false } };
+            bool any = false;
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    if (state && Undo_IsTileCaptured(state, tx, ty)) continue;
+                    Rectangle tileRect = { (float)(gx * CHUNK_SIZE + tx * UNDO_TILE_SIZE), (float)(gy * CHUNK_SIZE + ty * UNDO_TILE_SIZE), UNDO_TILE_SIZE, UNDO_TILE_SIZE };
+                    if (!Undo_ShapeTouches(shape, tileRect)) continue;
+                    want[ty][tx] = true;
+                    any = true;
+                }
+            }
+            if (!any) continue; // Already saved
+
+            CanvasChunk *chunk = Canvas_EditableChunk(canvas, gridPos);
+            CachedChunk *cached = chunk ? NULL : Cache_Edit(canvas, gridPos);
+            if (state == NULL) {
+                action->numChunks++;
+                action->chunkStates = (UndoChunkState*)realloc(action->chunkStates, action->numChunks * sizeof(UndoChunkState));
+                state = &action->chunkStates[action->numChunks - 1];
+                *state = (UndoChunkState){ .gridPos = gridPos };
+            }
+            // The copies are queued ahead of the stroke's draws, so they capture the tiles as they are now
+            Undo_CaptureTiles(canvas, state, chunk, cached, want);
+        }
+    }
+    Undo_EnforceVramBudget(undoState);
+}
+
+// Stores the before-state of every tile under worldRect that this action hasn't captured yet.
+// Must be called before drawing into the rectangle.
+void Undo_AddRegionToCurrentAction(Canvas *canvas, UndoState *undoState, Rectangle worldRect) {
+    UndoShape shape = { .bounds = worldRect };
+    Undo_AddShapeToCurrentAction(canvas, undoState, &shape);
+}
+
+// Saves only the tiles the stroke segment's capsule actually crosses
+void Undo_AddSegmentToCurrentAction(Canvas *canvas, UndoState *undoState, Vector2 start, Vector2 end, float radius) {
+    UndoShape shape = {
+        .bounds = { fminf(start.x, end.x) - radius, fminf(start.y, end.y) - radius, fabsf(end.x - start.x) + 2.0f * radius, fabsf(end.y - start.y) + 2.0f * radius },
+        .start = start, .end = end, .radius = radius
+    };
+    Undo_AddShapeToCurrentAction(canvas, undoState, &shape);
+}
+
+void Undo_EndAction(UndoState *undoState) {
+    if (undoState->currentAction == NULL || undoState->currentAction->numChunks == 0) {
+        if (undoState->currentAction) {
+            free(undoState->currentAction);
+            undoState->currentAction = NULL;
+        }
+        return;
+    }
+
+    // Clear the redo stack
+    while (undoState->redo.count > 0) {
+        UndoAction redoAction = Undo_PopAction(undoState, &undoState->redo);
+        Undo_FreeAction(undoState, &redoAction);
+    }
+
+    Undo_PushAction(undoState, &undoState->undo, *undoState->currentAction);
+    free(undoState->currentAction);
+    undoState->currentAction = NULL;
+    Undo_EnforceBudget(undoState);
+}
+
+// Writes the captured regions back into their chunks
+void ApplyUndoAction(Canvas *canvas, UndoAction *action) {
+    for (int i = 0; i < action->numChunks; i++) {
+        UndoChunkState *state = &action->chunkStates[i];
+        Canvas_Invalidate(canvas, ChunkRect(state->gridPos));
+        CanvasChunk* chunk = Canvas_ResidentChunk(canvas, state->gridPos);
+        if (chunk == NULL) {
+            CachedChunk *cached = Cache_Edit(canvas, state->gridPos);
+            for (int r = state->numRegions - 1; r >= 0; r--) {
+                UndoRegion *region = &state->regions[r];
+                if (region->texture.id != 0) {
+                    // Rare: a GPU snapshot of a chunk that has since left the pool
+                    Image pixels = LoadImageFromTexture(region->texture.texture);
+                    ImageFlipVertical(&pixels);
+                    Undo_CopyRegionPixels(cached->image, region, pixels, true);
+                    UnloadImage(pixels);
+                } else {
+                    Undo_CopyRegionPixels(cached->image, region, region->image, true);
+                }
+            }
+            Cache_MarkDirty(canvas, cached);
+        } else {
+            Canvas_MarkDirty(canvas, chunk);
+            RenderTexture2D page = Atlas_Page(&canvas->atlas, chunk->slot);
+            Vector2 origin = Atlas_SlotOrigin(chunk->slot);
+            // Latest region first, so where regions overlap the earliest capture is what remains
+            for (int r = state->numRegions - 1; r >= 0; r--) {
+                UndoRegion *region = &state->regions[r];
+                if (region->texture.id != 0) {
+                    GLExt_BlitRegion(region->texture, 0, 0, page, (int)origin.x + region->x, (int)origin.y + region->y, region->width, region->height);
+                    continue;
+                }
+                // Render textures are stored bottom-up
+                Image flipped = ImageCopy(region->image);
+                ImageFlipVertical(&flipped);
+                Rectangle rec = { origin.x + region->x, (float)ATLAS_PAGE_SIZE - (origin.y + region->y) - region->height, (float)region->width, (float)region->height };
+                UpdateTextureRec(page.texture, rec, flipped.data);
+                UnloadImage(flipped);
+            }
+        }
+    }
+}
+
+// Captures the current contents of the same regions an action holds, to swap it with
+static UndoAction Undo_CaptureCurrent(Canvas *canvas, const UndoAction *like) {
+    UndoAction action = {0};
+    action.numChunks = like->numChunks;
+    action.chunkStates = (UndoChunkState*)calloc(action.numChunks, sizeof(UndoChunkState));
+
+    for (int i = 0; i < like->numChunks; i++) {
+        const UndoChunkState *source = &like->chunkStates[i];
+        UndoChunkState *state = &action.chunkStates[i];
+        state->gridPos = source->gridPos;
+        memcpy(state->captured, source->captured, sizeof(state->captured));
+        CanvasChunk *chunk = Canvas_ResidentChunk(canvas, source->gridPos);
+        CachedChunk *cached = chunk ? NULL : Cache_Edit(canvas, source->gridPos);
+        for (int r = 0; r < source->numRegions; r++) {
+            const UndoRegion *region = &source->regions[r];
+            Undo_CaptureRegion(canvas, state, chunk, cached, region->x, region->y, region->width, region->height);
+        }
+    }
+    return action;
+}
+
+static void Undo_ApplyUndo(Canvas *canvas, UndoState *undoState) {
+    if (undoState->undo.count == 0) return;
+
+    // 1. Pop the action from the undo stack
+    UndoAction actionToUndo = Undo_PopAction(undoState, &undoState->undo);
+
+    // 2. Create a "redo" action to store the *current* state before we undo
+    UndoAction redoAction = Undo_CaptureCurrent(canvas, &actionToUndo);
+
+    // 3. Apply the "before" regions from the undo action back to the canvas
+    ApplyUndoAction(canvas, &actionToUndo);
+
+    // 4. Free the original undo action's regions
+    Undo_FreeAction(undoState, &actionToUndo);
+
+    // 5. Push the new redo action onto the redo stack
+    Undo_PushAction(undoState, &undoState->redo, redoAction);
+    Undo_EnforceBudget(undoState);
+    Undo_EnforceVramBudget(undoState);
+}
+
+static void Undo_ApplyRedo(Canvas *canvas, UndoState *undoState) {
+    if (undoState->redo.count == 0) return;
+
+    // 1. Pop the action from the redo stack
+    UndoAction actionToRedo = Undo_PopAction(undoState, &undoState->redo);
+
+    // 2. Create an "undo" action to store the *current* state before we redo
+    UndoAction undoAction = Undo_CaptureCurrent(canvas, &actionToRedo);
+
+    // 3. Apply the regions from the redo action back to the canvas
+    ApplyUndoAction(canvas, &actionToRedo);
+
+    // 4. Free the original redo action's regions
+    Undo_FreeAction(undoState, &actionToRedo);
+
+    // 5. Push the new undo action onto the undo stack
+    Undo_PushAction(undoState, &undoState->undo, undoAction);
+    Undo_EnforceBudget(undoState);
+    Undo_EnforceVramBudget(undoState);
+}
+
+static bool Undo_IsActionPending(UndoAction *action) {
+    for (int i = 0; i < action->numChunks; i++) {
+        for (int r = 0; r < action->chunkStates[i].numRegions; r++) {
+            const void *pixels = action->chunkStates[i].regions[r].image.data;
+            if (pixels && Readback_IsPending(pixels)) return true;
+        }
+    }
+    return false;
+}
+
+// Applies queued undo/redo steps once the chunk captures they restore have landed
+void Undo_Update(Canvas *canvas, UndoState *undoState) {
+    while (undoState->queuedSteps != 0) {
+        bool undo = undoState->queuedSteps < 0;
+        UndoRing *ring = undo ? &undoState->undo : &undoState->redo;
+        if (ring->count == 0) {
+            undoState->queuedSteps = 0;
+            break;
+        }
+        UndoAction *action = UndoRing_Newest(ring);
+        if (Undo_IsActionPending(action)) break;
+        if (undo) {
+            Undo_ApplyUndo(canvas, undoState);
+            undoState->queuedSteps++;
+        } else {
+            Undo_ApplyRedo(canvas, undoState);
+            undoState->queuedSteps--;
+        }
+    }
+}
+
+void Undo_PerformUndo(Canvas *canvas, UndoState *undoState) {
+    undoState->queuedSteps--;
+    Undo_Update(canvas, undoState);
+}
+
+void Undo_PerformRedo(Canvas *canvas, UndoState *undoState) {
+    undoState->queuedSteps++;
+    Undo_Update(canvas, undoState);
+}
+
+void Undo_Destroy(UndoState *undoState) {
+    while (undoState->undo.count > 0) {
+        UndoAction action = UndoRing_PopOldest(&undoState->undo);
+        Undo_FreeAction(undoState, &action);
+    }
+    while (undoState->redo.count > 0) {
+        UndoAction action = UndoRing_PopOldest(&undoState->redo);
+        Undo_FreeAction(undoState, &action);
+    }
+    free(undoState->undo.items);
+    free(undoState->redo.items);
+    undoState->undo = (UndoRing){0};
+    undoState->redo = (UndoRing){0};
+    undoState->bytes = 0;
+    if (undoState->currentAction) {
+        Undo_FreeAction(undoState, undoState->currentAction);
+        free(undoState->currentAction);
+        undoState->currentAction = NULL;
     }
 }
 